@@ -0,0 +1,86 @@
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+
+#include "parallel.h"
+#include "graph.h"
+#include "components.h"
+
+// nodes handled in a single parallel job
+#define LABEL_BATCH 4096
+
+// parents only ever point to lower nodes so the root of a set is its lowest node
+static uint32_t find_root(std::vector<std::atomic<uint32_t>> &parent, uint32_t node)
+{
+	while (true) {
+		uint32_t up = parent[node].load(std::memory_order_relaxed);
+		if (up == node) { return node; }
+		uint32_t grandparent = parent[up].load(std::memory_order_relaxed);
+		// path halving, losing the race only means the path stays a bit longer
+		if (grandparent != up) {
+			parent[node].compare_exchange_weak(up, grandparent, std::memory_order_relaxed);
+		}
+		node = grandparent;
+	}
+}
+
+static void unite(std::vector<std::atomic<uint32_t>> &parent, uint32_t a, uint32_t b)
+{
+	while (true) {
+		a = find_root(parent, a);
+		b = find_root(parent, b);
+		if (a == b) { return; }
+		if (a < b) { std::swap(a, b); }
+		// hang the higher root under the lower one, retry if another thread linked it first
+		uint32_t expected = a;
+		if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) {
+			return;
+		}
+	}
+}
+
+void label_components(const struct adjacency *graph, const std::vector<uint8_t> &classes, struct components *out)
+{
+	const size_t count = graph->size();
+
+	std::vector<std::atomic<uint32_t>> parent(count);
+	parallel_for(count, LABEL_BATCH, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			parent[i].store(i, std::memory_order_relaxed);
+		}
+	});
+
+	// every link is seen from both ends, only join it from its lower node
+	parallel_for(count, LABEL_BATCH, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			if (classes[i] == 0) { continue; }
+			for (uint32_t neighbor : (*graph)[i]) {
+				if (neighbor > i && classes[neighbor] == classes[i]) {
+					unite(parent, i, neighbor);
+				}
+			}
+		}
+	});
+
+	out->label.resize(count);
+	parallel_for(count, LABEL_BATCH, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			out->label[i] = classes[i] ? find_root(parent, i) : NO_COMPONENT;
+		}
+	});
+
+	// roots come before the other nodes of their set so one pass numbers them
+	out->size.clear();
+	for (size_t i = 0; i < count; i++) {
+		uint32_t root = out->label[i];
+		if (root == NO_COMPONENT) { continue; }
+		if (root == i) {
+			out->label[i] = out->size.size();
+			out->size.push_back(0);
+		} else {
+			out->label[i] = out->label[root];
+		}
+		out->size[out->label[i]]++;
+	}
+}
@@ -0,0 +1,15 @@
+/*
+ * components - parallel connected component labeling
+ */
+
+#define NO_COMPONENT 0xffffffff
+
+struct components {
+	std::vector<uint32_t> label; // component of each node, NO_COMPONENT for nodes of class 0
+	std::vector<uint32_t> size; // number of nodes in each component
+};
+
+// linked nodes that have the same nonzero class end up in the same component
+// uses a lock free union find, components are numbered in the order of their lowest node
+// so the labels don't depend on the number of workers
+void label_components(const struct adjacency *graph, const std::vector<uint8_t> &classes, struct components *out);
@@ -30,6 +30,7 @@
 
 #include <math.h>
 #include <assert.h>
+#include <string.h>
 
 #include <algorithm>
 #include <random>
@@ -2248,3 +2249,368 @@ void FastNoise::SingleGradientPerturb(unsigned char offset, FN_DECIMAL warpAmp,
 	x += Lerp(lx0x, lx1x, ys) * warpAmp;
 	y += Lerp(ly0x, ly1x, ys) * warpAmp;
 }
+
+// Batched 2D
+// The vector kernels use GCC vector extensions so the same source compiles to SSE2 (4 lanes) and AVX2 (8 lanes)
+// Every kernel repeats the operations of its scalar counterpart in the same order and without fused multiply-add,
+// the permutation table lookups are done per lane
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(FN_USE_DOUBLES)
+#define FN_BATCH_VECTORS
+#endif
+
+enum BatchNoise { BATCH_SCALAR, BATCH_PERLIN, BATCH_PERLIN_FBM, BATCH_SIMPLEX, BATCH_SIMPLEX_FBM };
+
+struct BatchParams
+{
+	const unsigned char* perm;
+	const unsigned char* perm12;
+	int interp;
+	int octaves;
+	FN_DECIMAL frequency;
+	FN_DECIMAL perturbFrequency;
+	FN_DECIMAL lacunarity;
+	FN_DECIMAL gain;
+	FN_DECIMAL fractalBounding;
+	FN_DECIMAL gradientPerturbAmp;
+};
+
+#ifdef FN_BATCH_VECTORS
+// vectors wider than the default target only ever live inside the AVX2 entry points
+// the kernels are instantiated at the end of the file so the warning stays off from here on
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+typedef float BatchF4 __attribute__((vector_size(16)));
+typedef int BatchI4 __attribute__((vector_size(16)));
+typedef float BatchF8 __attribute__((vector_size(32)));
+typedef int BatchI8 __attribute__((vector_size(32)));
+
+#define FN_BATCH_INLINE inline __attribute__((always_inline))
+
+template <class F, class I>
+static FN_BATCH_INLINE I BatchFloor(const F& f)
+{
+	I t = __builtin_convertvector(f, I);
+	return f >= 0 ? t : t - 1;
+}
+
+template <class F>
+static FN_BATCH_INLINE F BatchLerp(const F& a, const F& b, const F& t) { return a + t * (b - a); }
+
+template <class F>
+static FN_BATCH_INLINE F BatchInterp(int interp, const F& t)
+{
+	switch (interp)
+	{
+	case FastNoise::Hermite:
+		return t*t*(FN_DECIMAL(3) - 2 * t);
+	case FastNoise::Quintic:
+		return t*t*t*(t*(t * 6 - 15) + 10);
+	default:
+		return t;
+	}
+}
+
+template <class F, class I, int N>
+static FN_BATCH_INLINE F BatchGradCoord2D(const BatchParams& p, unsigned char offset, const I& x, const I& y, const F& xd, const F& yd)
+{
+	F gx = {}, gy = {};
+	for (int l = 0; l < N; l++)
+	{
+		unsigned char lutPos = p.perm12[(x[l] & 0xff) + p.perm[(y[l] & 0xff) + offset]];
+		gx[l] = GRAD_X[lutPos];
+		gy[l] = GRAD_Y[lutPos];
+	}
+
+	return xd*gx + yd*gy;
+}
+
+template <class F, class I, int N>
+static FN_BATCH_INLINE F BatchPerlin(const BatchParams& p, unsigned char offset, const F& x, const F& y)
+{
+	I x0 = BatchFloor<F, I>(x);
+	I y0 = BatchFloor<F, I>(y);
+	I x1 = x0 + 1;
+	I y1 = y0 + 1;
+
+	F xd0 = x - __builtin_convertvector(x0, F);
+	F yd0 = y - __builtin_convertvector(y0, F);
+	F xs = BatchInterp(p.interp, xd0);
+	F ys = BatchInterp(p.interp, yd0);
+	F xd1 = xd0 - 1;
+	F yd1 = yd0 - 1;
+
+	F xf0 = BatchLerp(BatchGradCoord2D<F, I, N>(p, offset, x0, y0, xd0, yd0), BatchGradCoord2D<F, I, N>(p, offset, x1, y0, xd1, yd0), xs);
+	F xf1 = BatchLerp(BatchGradCoord2D<F, I, N>(p, offset, x0, y1, xd0, yd1), BatchGradCoord2D<F, I, N>(p, offset, x1, y1, xd1, yd1), xs);
+
+	return BatchLerp(xf0, xf1, ys);
+}
+
+template <class F, class I, int N>
+static FN_BATCH_INLINE F BatchSimplexCorner(const BatchParams& p, unsigned char offset, const I& i, const I& j, const F& x, const F& y)
+{
+	F t = FN_DECIMAL(0.5) - x*x - y*y;
+	F t2 = t*t;
+	F n = t2*t2*BatchGradCoord2D<F, I, N>(p, offset, i, j, x, y);
+	F zero = {};
+
+	return t < 0 ? zero : n;
+}
+
+template <class F, class I, int N>
+static FN_BATCH_INLINE F BatchSimplex(const BatchParams& p, unsigned char offset, const F& x, const F& y)
+{
+	F t = (x + y) * F2;
+	I i = BatchFloor<F, I>(x + t);
+	I j = BatchFloor<F, I>(y + t);
+
+	t = __builtin_convertvector(i + j, F) * G2;
+	F X0 = __builtin_convertvector(i, F) - t;
+	F Y0 = __builtin_convertvector(j, F) - t;
+
+	F x0 = x - X0;
+	F y0 = y - Y0;
+
+	// comparisons give -1 for true lanes
+	I i1 = (x0 > y0) & 1;
+	I j1 = 1 - i1;
+
+	F x1 = x0 - __builtin_convertvector(i1, F) + G2;
+	F y1 = y0 - __builtin_convertvector(j1, F) + G2;
+	F x2 = x0 - 1 + 2*G2;
+	F y2 = y0 - 1 + 2*G2;
+
+	F n0 = BatchSimplexCorner<F, I, N>(p, offset, i, j, x0, y0);
+	F n1 = BatchSimplexCorner<F, I, N>(p, offset, i + i1, j + j1, x1, y1);
+	F n2 = BatchSimplexCorner<F, I, N>(p, offset, i + 1, j + 1, x2, y2);
+
+	return 70 * (n0 + n1 + n2);
+}
+
+template <class F, class I, int N, bool SIMPLEX>
+static FN_BATCH_INLINE F BatchSingle(const BatchParams& p, unsigned char offset, const F& x, const F& y)
+{
+	return SIMPLEX ? BatchSimplex<F, I, N>(p, offset, x, y) : BatchPerlin<F, I, N>(p, offset, x, y);
+}
+
+template <class F, class I, int N, bool SIMPLEX>
+static FN_BATCH_INLINE F BatchFractalFBM(const BatchParams& p, F& x, F& y)
+{
+	F sum = BatchSingle<F, I, N, SIMPLEX>(p, p.perm[0], x, y);
+	FN_DECIMAL amp = 1;
+	int i = 0;
+
+	while (++i < p.octaves)
+	{
+		x *= p.lacunarity;
+		y *= p.lacunarity;
+
+		amp *= p.gain;
+		sum += BatchSingle<F, I, N, SIMPLEX>(p, p.perm[i], x, y) * amp;
+	}
+
+	return sum * p.fractalBounding;
+}
+
+template <class F, class I, int N>
+static FN_BATCH_INLINE void BatchGradientPerturb(const BatchParams& p, unsigned char offset, FN_DECIMAL warpAmp, FN_DECIMAL frequency, F& x, F& y)
+{
+	F xf = x * frequency;
+	F yf = y * frequency;
+
+	I x0 = BatchFloor<F, I>(xf);
+	I y0 = BatchFloor<F, I>(yf);
+	I x1 = x0 + 1;
+	I y1 = y0 + 1;
+
+	F xs = BatchInterp(p.interp, xf - __builtin_convertvector(x0, F));
+	F ys = BatchInterp(p.interp, yf - __builtin_convertvector(y0, F));
+
+	F x00 = {}, y00 = {}, x10 = {}, y10 = {}, x01 = {}, y01 = {}, x11 = {}, y11 = {};
+	for (int l = 0; l < N; l++)
+	{
+		int lutPos = p.perm[(x0[l] & 0xff) + p.perm[(y0[l] & 0xff) + offset]];
+		x00[l] = CELL_2D_X[lutPos];
+		y00[l] = CELL_2D_Y[lutPos];
+		lutPos = p.perm[(x1[l] & 0xff) + p.perm[(y0[l] & 0xff) + offset]];
+		x10[l] = CELL_2D_X[lutPos];
+		y10[l] = CELL_2D_Y[lutPos];
+		lutPos = p.perm[(x0[l] & 0xff) + p.perm[(y1[l] & 0xff) + offset]];
+		x01[l] = CELL_2D_X[lutPos];
+		y01[l] = CELL_2D_Y[lutPos];
+		lutPos = p.perm[(x1[l] & 0xff) + p.perm[(y1[l] & 0xff) + offset]];
+		x11[l] = CELL_2D_X[lutPos];
+		y11[l] = CELL_2D_Y[lutPos];
+	}
+
+	F lx0x = BatchLerp(x00, x10, xs);
+	F ly0x = BatchLerp(y00, y10, xs);
+	F lx1x = BatchLerp(x01, x11, xs);
+	F ly1x = BatchLerp(y01, y11, xs);
+
+	x += BatchLerp(lx0x, lx1x, ys) * warpAmp;
+	y += BatchLerp(ly0x, ly1x, ys) * warpAmp;
+}
+
+template <class F, class I, int N>
+static FN_BATCH_INLINE void BatchNoiseSet(const BatchParams& p, int kind, const FN_DECIMAL* x, const FN_DECIMAL* y, FN_DECIMAL* out, int count)
+{
+	for (int start = 0; start < count; start += N)
+	{
+		int lanes = std::min(N, count - start);
+		F vx = {}, vy = {};
+		memcpy(&vx, x + start, lanes * sizeof(FN_DECIMAL));
+		memcpy(&vy, y + start, lanes * sizeof(FN_DECIMAL));
+		vx *= p.frequency;
+		vy *= p.frequency;
+
+		F v = {};
+		switch (kind)
+		{
+		case BATCH_PERLIN:
+			v = BatchPerlin<F, I, N>(p, 0, vx, vy);
+			break;
+		case BATCH_PERLIN_FBM:
+			v = BatchFractalFBM<F, I, N, false>(p, vx, vy);
+			break;
+		case BATCH_SIMPLEX:
+			v = BatchSimplex<F, I, N>(p, 0, vx, vy);
+			break;
+		case BATCH_SIMPLEX_FBM:
+			v = BatchFractalFBM<F, I, N, true>(p, vx, vy);
+			break;
+		}
+
+		memcpy(out + start, &v, lanes * sizeof(FN_DECIMAL));
+	}
+}
+
+template <class F, class I, int N>
+static FN_BATCH_INLINE void BatchGradientPerturbFractalSet(const BatchParams& p, FN_DECIMAL* x, FN_DECIMAL* y, int count)
+{
+	for (int start = 0; start < count; start += N)
+	{
+		int lanes = std::min(N, count - start);
+		F vx = {}, vy = {};
+		memcpy(&vx, x + start, lanes * sizeof(FN_DECIMAL));
+		memcpy(&vy, y + start, lanes * sizeof(FN_DECIMAL));
+
+		FN_DECIMAL amp = p.gradientPerturbAmp * p.fractalBounding;
+		FN_DECIMAL freq = p.perturbFrequency;
+		int i = 0;
+
+		BatchGradientPerturb<F, I, N>(p, p.perm[0], amp, p.frequency, vx, vy);
+
+		while (++i < p.octaves)
+		{
+			freq *= p.lacunarity;
+			amp *= p.gain;
+			BatchGradientPerturb<F, I, N>(p, p.perm[i], amp, freq, vx, vy);
+		}
+
+		memcpy(x + start, &vx, lanes * sizeof(FN_DECIMAL));
+		memcpy(y + start, &vy, lanes * sizeof(FN_DECIMAL));
+	}
+}
+
+__attribute__((target("sse2")))
+static void BatchNoiseSetSSE2(const BatchParams& p, int kind, const FN_DECIMAL* x, const FN_DECIMAL* y, FN_DECIMAL* out, int count)
+{
+	BatchNoiseSet<BatchF4, BatchI4, 4>(p, kind, x, y, out, count);
+}
+
+__attribute__((target("avx2")))
+static void BatchNoiseSetAVX2(const BatchParams& p, int kind, const FN_DECIMAL* x, const FN_DECIMAL* y, FN_DECIMAL* out, int count)
+{
+	BatchNoiseSet<BatchF8, BatchI8, 8>(p, kind, x, y, out, count);
+}
+
+__attribute__((target("sse2")))
+static void BatchGradientPerturbFractalSetSSE2(const BatchParams& p, FN_DECIMAL* x, FN_DECIMAL* y, int count)
+{
+	BatchGradientPerturbFractalSet<BatchF4, BatchI4, 4>(p, x, y, count);
+}
+
+__attribute__((target("avx2")))
+static void BatchGradientPerturbFractalSetAVX2(const BatchParams& p, FN_DECIMAL* x, FN_DECIMAL* y, int count)
+{
+	BatchGradientPerturbFractalSet<BatchF8, BatchI8, 8>(p, x, y, count);
+}
+
+enum BatchLevel { BATCH_NONE, BATCH_SSE2, BATCH_AVX2 };
+
+static BatchLevel DetectBatchLevel()
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return BATCH_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return BATCH_SSE2;
+
+	return BATCH_NONE;
+}
+
+static BatchLevel GetBatchLevel()
+{
+	static const BatchLevel level = DetectBatchLevel();
+
+	return level;
+}
+#endif
+
+void FastNoise::GetNoiseSet(const FN_DECIMAL* x, const FN_DECIMAL* y, FN_DECIMAL* out, int count) const
+{
+	BatchNoise kind = BATCH_SCALAR;
+	switch (m_noiseType)
+	{
+	case Perlin:
+		kind = BATCH_PERLIN;
+		break;
+	case PerlinFractal:
+		if (m_fractalType == FBM) kind = BATCH_PERLIN_FBM;
+		break;
+	case Simplex:
+		kind = BATCH_SIMPLEX;
+		break;
+	case SimplexFractal:
+		if (m_fractalType == FBM) kind = BATCH_SIMPLEX_FBM;
+		break;
+	default:
+		break;
+	}
+
+#ifdef FN_BATCH_VECTORS
+	BatchLevel level = GetBatchLevel();
+	if (kind != BATCH_SCALAR && level != BATCH_NONE)
+	{
+		BatchParams params = { m_perm, m_perm12, m_interp, m_octaves, m_frequency, m_perturbFrequency, m_lacunarity, m_gain, m_fractalBounding, m_gradientPerturbAmp };
+		if (level == BATCH_AVX2)
+			BatchNoiseSetAVX2(params, kind, x, y, out, count);
+		else
+			BatchNoiseSetSSE2(params, kind, x, y, out, count);
+		return;
+	}
+#endif
+
+	for (int i = 0; i < count; i++)
+		out[i] = GetNoise(x[i], y[i]);
+}
+
+void FastNoise::GradientPerturbFractalSet(FN_DECIMAL* x, FN_DECIMAL* y, int count) const
+{
+#ifdef FN_BATCH_VECTORS
+	BatchLevel level = GetBatchLevel();
+	if (level != BATCH_NONE)
+	{
+		BatchParams params = { m_perm, m_perm12, m_interp, m_octaves, m_frequency, m_perturbFrequency, m_lacunarity, m_gain, m_fractalBounding, m_gradientPerturbAmp };
+		if (level == BATCH_AVX2)
+			BatchGradientPerturbFractalSetAVX2(params, x, y, count);
+		else
+			BatchGradientPerturbFractalSetSSE2(params, x, y, count);
+		return;
+	}
+#endif
+
+	for (int i = 0; i < count; i++)
+		GradientPerturbFractal(x[i], y[i]);
+}
@@ -36,6 +36,10 @@
 
 #define FN_CELLULAR_INDEX_MAX 3
 
+// Largest difference between a batched sample and the same sample from the single point functions
+// The vector paths repeat the scalar operations in the same order so in practice they match exactly
+#define FN_BATCH_EPSILON FN_DECIMAL(1e-6)
+
 #ifdef FN_USE_DOUBLES
 typedef double FN_DECIMAL;
 #else
@@ -185,6 +189,15 @@ public:
 	void GradientPerturb(FN_DECIMAL& x, FN_DECIMAL& y) const;
 	void GradientPerturbFractal(FN_DECIMAL& x, FN_DECIMAL& y) const;
 
+	//2D batched
+	// Evaluates count samples per call, out[i] = GetNoise(x[i], y[i])
+	// Perlin, Simplex and their FBM fractals run on AVX2 or SSE2 lanes picked at runtime
+	// Other noise types and CPUs without SIMD support fall back to the single point functions
+	void GetNoiseSet(const FN_DECIMAL* x, const FN_DECIMAL* y, FN_DECIMAL* out, int count) const;
+
+	// Same as calling GradientPerturbFractal(x[i], y[i]) for every sample
+	void GradientPerturbFractalSet(FN_DECIMAL* x, FN_DECIMAL* y, int count) const;
+
 	//3D
 	FN_DECIMAL GetValue(FN_DECIMAL x, FN_DECIMAL y, FN_DECIMAL z) const;
 	FN_DECIMAL GetValueFractal(FN_DECIMAL x, FN_DECIMAL y, FN_DECIMAL z) const;
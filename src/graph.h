@@ -0,0 +1,113 @@
+/*
+ * graph - compact index based adjacency storage
+ */
+
+// read only view on a contiguous run of node indices
+struct span {
+	const uint32_t *first = nullptr;
+	const uint32_t *last = nullptr;
+	const uint32_t *begin(void) const { return first; }
+	const uint32_t *end(void) const { return last; }
+	size_t size(void) const { return last - first; }
+	bool empty(void) const { return first == last; }
+	uint32_t operator[](size_t i) const { return first[i]; }
+};
+
+// compressed sparse row adjacency
+// the links of node i are stored in links from offsets[i] up to offsets[i+1]
+struct adjacency {
+	std::vector<uint32_t> offsets = {0};
+	std::vector<uint32_t> links;
+	size_t size(void) const { return offsets.size() - 1; }
+	struct span operator[](size_t node) const
+	{
+		struct span s;
+		s.first = links.data() + offsets[node];
+		s.last = links.data() + offsets[node+1];
+		return s;
+	}
+};
+
+// closes the links of the next node, call after appending its links
+inline void end_node(struct adjacency *graph)
+{
+	graph->offsets.push_back(graph->links.size());
+}
+
+inline void clear_adjacency(struct adjacency *graph)
+{
+	graph->offsets.assign(1, 0);
+	graph->links.clear();
+}
+
+// visited flags that are all cleared at once by moving to the next epoch
+struct marker {
+	std::vector<uint32_t> stamps;
+	uint32_t epoch = 0;
+};
+
+inline void reset_marker(struct marker *marker, size_t count)
+{
+	marker->epoch++;
+	if (marker->stamps.size() != count || marker->epoch == 0) {
+		marker->stamps.assign(count, 0);
+		marker->epoch = 1;
+	}
+}
+
+inline bool marked(const struct marker *marker, uint32_t node)
+{
+	return marker->stamps[node] == marker->epoch;
+}
+
+// marks the node, returns false if it was already marked
+inline bool mark(struct marker *marker, uint32_t node)
+{
+	if (marker->stamps[node] == marker->epoch) { return false; }
+	marker->stamps[node] = marker->epoch;
+	return true;
+}
+
+// first in first out queue of node indices on a ring buffer that only grows
+struct ring_queue {
+	std::vector<uint32_t> items = std::vector<uint32_t>(64);
+	size_t head = 0; // next node to pop
+	size_t tail = 0; // slot of the next push
+	bool empty(void) const { return head == tail; }
+	void clear(void) { head = tail = 0; }
+	void push(uint32_t node)
+	{
+		if (tail - head == items.size()) {
+			// unwrap the queue into a buffer twice the size
+			std::vector<uint32_t> grown(2 * items.size());
+			for (size_t i = head; i < tail; i++) {
+				grown[i - head] = items[i & (items.size() - 1)];
+			}
+			items.swap(grown);
+			tail -= head;
+			head = 0;
+		}
+		items[tail++ & (items.size() - 1)] = node;
+	}
+	uint32_t pop(void)
+	{
+		return items[head++ & (items.size() - 1)];
+	}
+};
+
+// scratch state for breadth first searches, reused between passes so they don't allocate
+struct traversal {
+	struct marker visited;
+	std::vector<int> depth;
+	struct ring_queue queue;
+	std::vector<uint32_t> found; // nodes collected by the current search
+};
+
+// prepares a search over count nodes, all unvisited at depth 0
+inline void begin_traversal(struct traversal *walk, size_t count)
+{
+	reset_marker(&walk->visited, count);
+	walk->depth.assign(count, 0);
+	walk->queue.clear();
+	walk->found.clear();
+}
@@ -1,14 +1,23 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstring>
 #include <glm/vec3.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#define IIR_GAUSS_BLUR_IMPLEMENTATION
-#include "extern/iir_gauss_blur.h"
+#include "extern/stb_image_write.h"
 
 #include "geom.h"
+#include "parallel.h"
 #include "imp.h"
 
+// number of image rows converted or filtered in a single parallel job
+#define BLUR_BAND_ROWS 16
+// number of interleaved channel columns filtered in a single parallel job, a block row fills a cache line
+#define BLUR_BLOCK_COLUMNS 16
+
 static void push(std::vector<int> &stack, int x, int y)
 {
 	stack.push_back(x);
@@ -70,6 +79,52 @@ void delete_floatimage(const floatimage *image)
 	}
 }
 
+struct shortimage blank_shortimage(unsigned int nchannels, size_t width, size_t height)
+{
+	struct shortimage image = {
+		.data = new unsigned short[width*height*nchannels],
+		.nchannels = nchannels,
+		.width = width,
+		.height = height,
+	};
+	memset(image.data, 0, image.nchannels*image.width*image.height*sizeof(unsigned short));
+
+	return image;
+}
+
+void delete_shortimage(const shortimage *image)
+{
+	if (image->data != nullptr) {
+		delete [] image->data;
+	}
+}
+
+struct byteimage shortimage_to_byteimage(const struct shortimage *image)
+{
+	struct byteimage bytes = blank_byteimage(image->nchannels, image->width, image->height);
+
+	const size_t size = image->nchannels * image->width * image->height;
+	for (size_t i = 0; i < size; i++) {
+		// round to the nearest 8 bit level
+		bytes.data[i] = (image->data[i] + 128) / 257;
+	}
+
+	return bytes;
+}
+
+void write_shortimage_png(const char *fpath, const struct shortimage *image)
+{
+	if (image->data == nullptr) {
+		std::cerr << "error: no image data\n";
+		return;
+	}
+
+	struct byteimage bytes = shortimage_to_byteimage(image);
+	stbi_write_png(fpath, bytes.width, bytes.height, bytes.nchannels, bytes.data, bytes.width*bytes.nchannels);
+
+	delete_byteimage(&bytes);
+}
+
 int RGB_to_int(unsigned char r, unsigned char g, unsigned char b)
 {
 	return 65536 * r + 256 * g + b;
@@ -290,6 +345,136 @@ int floodfill(int *image, size_t w, size_t h, int x, int y, int newcolor, int ol
 	return total;
 }
 
+
+float sample_shortimage(int x, int y, enum channel chan, const struct shortimage *image)
+{
+	if (image->data == nullptr) {
+		std::cerr << "error: no image data\n";
+		return 0.f;
+	}
+	if (chan > image->nchannels) {
+		std::cerr << "error: invalid channel to sample\n";
+		return 0.f;
+	}
+	if (x < 0 || y < 0 || x > (image->width-1) || y > (image->height-1)) {
+		return 0.f;
+	}
+
+	int index = y * image->width * image->nchannels + x * image->nchannels;
+
+	return image->data[index+chan] / 65535.f;
+}
+
+// recursive gaussian filter, constant cost regardless of sigma
+// see "Recursive implementation of the Gaussian filter" by Ian T. Young and Lucas J. van Vliet
+struct gauss_kernel make_gauss_kernel(float sigma)
+{
+	struct gauss_kernel kernel = {};
+
+	// sigma too small to have any effect
+	if (sigma < 0.5f) { return kernel; }
+
+	float q;
+	if (sigma >= 2.5f) {
+		q = 0.98711f * sigma - 0.96330f;
+	} else {
+		q = 3.97156f - 4.14554f * sqrtf(1.f - 0.26891f * sigma);
+	}
+
+	kernel.active = true;
+	kernel.b0 = 1.57825f + 2.44413f*q + 1.4281f*q*q + 0.422205f*q*q*q;
+	kernel.b1 = 2.44413f*q + 2.85619f*q*q + 1.26661f*q*q*q;
+	kernel.b2 = -(1.4281f*q*q + 1.26661f*q*q*q);
+	kernel.b3 = 0.422205f*q*q*q;
+	kernel.B = 1.f - (kernel.b1 + kernel.b2 + kernel.b3) / kernel.b0;
+
+	return kernel;
+}
+
+void gauss_filter_line(const struct gauss_kernel *kernel, float *line, int count, int stride)
+{
+	const float B = kernel->B;
+	const float b0 = kernel->b0;
+	const float b1 = kernel->b1;
+	const float b2 = kernel->b2;
+	const float b3 = kernel->b3;
+
+	float prev1 = line[0];
+	float prev2 = prev1;
+	float prev3 = prev1;
+	for (int i = 0; i < count; i++) {
+		float val = B * line[i*stride] + (b1 * prev1 + b2 * prev2 + b3 * prev3) / b0;
+		line[i*stride] = val;
+		prev3 = prev2; prev2 = prev1; prev1 = val;
+	}
+	prev1 = line[(count-1)*stride];
+	prev2 = prev1;
+	prev3 = prev1;
+	for (int i = count-1; i >= 0; i--) {
+		float val = B * line[i*stride] + (b1 * prev1 + b2 * prev2 + b3 * prev3) / b0;
+		line[i*stride] = val;
+		prev3 = prev2; prev2 = prev1; prev1 = val;
+	}
+}
+
+void gauss_filter_block(const struct gauss_kernel *kernel, float *block, int count, int stride, int width)
+{
+	const float B = kernel->B;
+	const float b0 = kernel->b0;
+	const float b1 = kernel->b1;
+	const float b2 = kernel->b2;
+	const float b3 = kernel->b3;
+
+	// each row of the block is contiguous so the filter streams through memory instead of striding per column
+	std::vector<float> prev(3 * width);
+	float *prev1 = &prev[0];
+	float *prev2 = &prev[width];
+	float *prev3 = &prev[2*width];
+
+	for (int n = 0; n < width; n++) {
+		prev1[n] = prev2[n] = prev3[n] = block[n];
+	}
+	for (int i = 0; i < count; i++) {
+		float *row = &block[i*stride];
+		for (int n = 0; n < width; n++) {
+			float val = B * row[n] + (b1 * prev1[n] + b2 * prev2[n] + b3 * prev3[n]) / b0;
+			row[n] = val;
+			prev3[n] = prev2[n]; prev2[n] = prev1[n]; prev1[n] = val;
+		}
+	}
+
+	for (int n = 0; n < width; n++) {
+		prev1[n] = prev2[n] = prev3[n] = block[(count-1)*stride + n];
+	}
+	for (int i = count-1; i >= 0; i--) {
+		float *row = &block[i*stride];
+		for (int n = 0; n < width; n++) {
+			float val = B * row[n] + (b1 * prev1[n] + b2 * prev2[n] + b3 * prev3[n]) / b0;
+			row[n] = val;
+			prev3[n] = prev2[n]; prev2[n] = prev1[n]; prev1[n] = val;
+		}
+	}
+}
+
+// separable blur of an interleaved float buffer
+// rows are filtered in parallel bands, columns in parallel blocks so the vertical pass walks memory row by row
+static void blur_buffer(float *buffer, int width, int height, int nchannels, const struct gauss_kernel *kernel)
+{
+	const int pitch = width * nchannels;
+
+	parallel_for(height, BLUR_BAND_ROWS, [&](size_t first, size_t last) {
+		for (int y = first; y < last; y++) {
+			for (int n = 0; n < nchannels; n++) {
+				gauss_filter_line(kernel, &buffer[y*pitch + n], width, nchannels);
+			}
+		}
+	});
+
+	parallel_for(pitch, BLUR_BLOCK_COLUMNS, [&](size_t first, size_t last) {
+		gauss_filter_block(kernel, &buffer[first], height, pitch, last - first);
+	});
+}
+
 void gauss_blur_image(struct byteimage *image, float sigma)
 {
 	if (image->data == nullptr) {
@@ -297,7 +482,64 @@ void gauss_blur_image(struct byteimage *image, float sigma)
 		return;
 	}
 
-	iir_gauss_blur(image->width, image->height, image->nchannels, image->data, sigma);
+	struct gauss_kernel kernel = make_gauss_kernel(sigma);
+	if (!kernel.active) { return; }
+
+	const size_t pitch = image->width * image->nchannels;
+	std::vector<float> buffer(pitch * image->height);
+	parallel_for(buffer.size(), BLUR_BAND_ROWS*pitch, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			buffer[i] = image->data[i];
+		}
+	});
+
+	blur_buffer(buffer.data(), image->width, image->height, image->nchannels, &kernel);
+
+	parallel_for(buffer.size(), BLUR_BAND_ROWS*pitch, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			image->data[i] = std::min(std::max(buffer[i], 0.f), 255.f);
+		}
+	});
+}
+
+void gauss_blur_shortimage(struct shortimage *image, float sigma)
+{
+	if (image->data == nullptr) {
+		std::cerr << "blur error: no memory present\n";
+		return;
+	}
+
+	struct gauss_kernel kernel = make_gauss_kernel(sigma);
+	if (!kernel.active) { return; }
+
+	const size_t pitch = image->width * image->nchannels;
+	std::vector<float> buffer(pitch * image->height);
+	parallel_for(buffer.size(), BLUR_BAND_ROWS*pitch, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			buffer[i] = image->data[i];
+		}
+	});
+
+	blur_buffer(buffer.data(), image->width, image->height, image->nchannels, &kernel);
+
+	parallel_for(buffer.size(), BLUR_BAND_ROWS*pitch, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			image->data[i] = std::min(std::max(buffer[i] + 0.5f, 0.f), 65535.f);
+		}
+	});
+}
+
+void gauss_blur_floatimage(struct floatimage *image, float sigma)
+{
+	if (image->data == nullptr) {
+		std::cerr << "blur error: no memory present\n";
+		return;
+	}
+
+	struct gauss_kernel kernel = make_gauss_kernel(sigma);
+	if (!kernel.active) { return; }
+
+	blur_buffer(image->data, image->width, image->height, image->nchannels, &kernel);
 }
 
 static inline float sample_height(int x, int y, const struct floatimage *image)
@@ -22,12 +22,30 @@ struct byteimage {
 	size_t height;
 };
 
+// 16 bit per channel image, used when 256 levels cause banding
+struct shortimage {
+	unsigned short *data = nullptr;
+	unsigned int nchannels;
+	size_t width;
+	size_t height;
+};
+
 struct byteimage blank_byteimage(unsigned int nchannels, size_t width, size_t height);
 
 void delete_byteimage(const byteimage *image);
 
 void delete_floatimage(const floatimage *image);
 
+struct shortimage blank_shortimage(unsigned int nchannels, size_t width, size_t height);
+
+void delete_shortimage(const shortimage *image);
+
+// quantizes to 8 bits, for writing to image formats
+struct byteimage shortimage_to_byteimage(const struct shortimage *image);
+
+// only converts to 8 bits while writing
+void write_shortimage_png(const char *fpath, const struct shortimage *image);
+
 int RGB_to_int(unsigned char r, unsigned char g, unsigned char b);
 
 void plot(int x, int y, unsigned char *image, int width, int height, int nchannels, unsigned char *color);
@@ -40,6 +58,27 @@ int floodfill(int *image, size_t w, size_t h, int x, int y, int newcolor, int ol
 
 void gauss_blur_image(struct byteimage *image, float sigma);
 
+float sample_shortimage(int x, int y, enum channel chan, const struct shortimage *image);
+
+void gauss_blur_shortimage(struct shortimage *image, float sigma);
+
+void gauss_blur_floatimage(struct floatimage *image, float sigma);
+
+// coefficients of the recursive gaussian filter, inactive when sigma is too small to blur
+struct gauss_kernel {
+	bool active;
+	float B;
+	float b0, b1, b2, b3;
+};
+
+struct gauss_kernel make_gauss_kernel(float sigma);
+
+// forward and backward filter over count samples that are stride floats apart
+void gauss_filter_line(const struct gauss_kernel *kernel, float *line, int count, int stride);
+
+// filters width adjacent columns at once, the count rows of the block are stride floats apart
+void gauss_filter_block(const struct gauss_kernel *kernel, float *block, int count, int stride, int width);
+
 float sample_floatimage(int x, int y, enum channel chan, const struct floatimage *image);
 
 struct floatimage gen_normalmap(const struct floatimage *heightmap);
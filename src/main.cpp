@@ -7,6 +7,8 @@
 #include <list>
 #include <thread>
 #include <chrono>
+#include <functional>
+#include <future>
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 
@@ -19,10 +21,15 @@
 
 #include "geom.h"
 #include "imp.h"
+#include "graph.h"
+#include "components.h"
+#include "naming.h"
 #include "voronoi.h"
 #include "terra.h"
 #include "worldmap.h"
 #include "saver.h"
+#include "worldfile.h"
+#include "worldpack.h"
 
 struct customedge {
 	std::pair<size_t, size_t> vertices;
@@ -84,10 +91,13 @@ static void fill_image_tiles(const Worldmap *worldmap, int start, int end, struc
 		color[2] = 255 * base * rgb.z;
 
 		glm::vec2 a = {round(t.center.x), round(t.center.y)};
-		for (const auto &bord : t.borders) {
+		for (uint32_t index : worldmap->graph.borders[t.index]) {
+			const struct border &bord = worldmap->borders[index];
+			const glm::vec2 &p0 = worldmap->corners[bord.c0].position;
+			const glm::vec2 &p1 = worldmap->corners[bord.c1].position;
 			// round points to rasterize properly
-			glm::vec2 b = {round(bord->c0->position.x), round(bord->c0->position.y)};
-			glm::vec2 c = {round(bord->c1->position.x), round(bord->c1->position.y)};
+			glm::vec2 b = {round(p0.x), round(p0.y)};
+			glm::vec2 c = {round(p1.x), round(p1.y)};
 			draw_triangle(a, b, c, image->data, image->width, image->height, image->nchannels, color);
 		}
 	}
@@ -118,10 +128,12 @@ void print_image(const Worldmap *worldmap)
 	std::cout << "image elapsed time: " << elapsed_seconds.count() << "s\n";
 
 	for (const auto &b : worldmap->borders) {
+		const glm::vec2 &p0 = worldmap->corners[b.c0].position;
+		const glm::vec2 &p1 = worldmap->corners[b.c1].position;
 		if (b.river) {
-			draw_thick_line(b.c0->position.x, b.c0->position.y, b.c1->position.x, b.c1->position.y, 2, image.data, image.width, image.height, image.nchannels, blu);
+			draw_thick_line(p0.x, p0.y, p1.x, p1.y, 2, image.data, image.width, image.height, image.nchannels, blu);
 		} else {
-			//draw_line(b.c0->position.x, b.c0->position.y, b.c1->position.x, b.c1->position.y, image.data, image.width, image.height, image.nchannels, red);
+			//draw_line(p0.x, p0.y, p1.x, p1.y, image.data, image.width, image.height, image.nchannels, red);
 		}
 	}
 	/*
@@ -167,12 +179,16 @@ void print_cultures(const Worldmap *worldmap)
 		color[0] = distrib(gen) * 255;
 		color[1] = distrib(gen) * 255;
 		color[2] = distrib(gen) * 255;
-		for (const auto &land : hold.lands) {
-			glm::vec2 a = {round(land->center.x), round(land->center.y)};
-			for (const auto &bord : land->borders) {
+		for (uint32_t land : hold.lands) {
+			const glm::vec2 &center = worldmap->tiles[land].center;
+			glm::vec2 a = {round(center.x), round(center.y)};
+			for (uint32_t index : worldmap->graph.borders[land]) {
+				const struct border &bord = worldmap->borders[index];
+				const glm::vec2 &p0 = worldmap->corners[bord.c0].position;
+				const glm::vec2 &p1 = worldmap->corners[bord.c1].position;
 				// round points to rasterize properly
-				glm::vec2 b = {round(bord->c0->position.x), round(bord->c0->position.y)};
-				glm::vec2 c = {round(bord->c1->position.x), round(bord->c1->position.y)};
+				glm::vec2 b = {round(p0.x), round(p0.y)};
+				glm::vec2 c = {round(p1.x), round(p1.y)};
 				draw_triangle(a, b, c, image.data, image.width, image.height, image.nchannels, color);
 			}
 		}
@@ -196,9 +212,11 @@ void print_cultures(const Worldmap *worldmap)
 		}
 	}
 	for (auto &bord : worldmap->borders) {
-		if (bord.t0->hold != bord.t1->hold) {
-			glm::vec2 b = {round(bord.c0->position.x), round(bord.c0->position.y)};
-			glm::vec2 c = {round(bord.c1->position.x), round(bord.c1->position.y)};
+		if (worldmap->tiles[bord.t0].hold != worldmap->tiles[bord.t1].hold) {
+			const glm::vec2 &p0 = worldmap->corners[bord.c0].position;
+			const glm::vec2 &p1 = worldmap->corners[bord.c1].position;
+			glm::vec2 b = {round(p0.x), round(p0.y)};
+			glm::vec2 c = {round(p1.x), round(p1.y)};
 			draw_line(b.x, b.y, c.x, c.y, image.data, image.width, image.height, image.nchannels, ora);
 		}
 	}
@@ -209,24 +227,26 @@ void print_cultures(const Worldmap *worldmap)
 	delete_byteimage(&image);
 }
 
-void print_hold(const struct holding *hold)
+void print_hold(const Worldmap *worldmap, const struct holding *hold)
 {
-	printf("The name of the hold is %s\n", hold->name.c_str());
-	if (hold->center->site == TOWN) {
-		printf("Its capital is the town of %s located at %f, %f\n", hold->center->name.c_str(), hold->center->center.x, hold->center->center.y);
+	const struct tile *center = &worldmap->tiles[hold->center];
+	printf("The name of the hold is %s\n", name_string(&worldmap->names, hold->name));
+	if (center->site == TOWN) {
+		printf("Its capital is the town of %s located at %f, %f\n", name_string(&worldmap->names, center->name), center->center.x, center->center.y);
 	}
-	if (hold->center->site == CASTLE) {
-		printf("Its capital is the castle of %s located at %f, %f\n", hold->center->name.c_str(), hold->center->center.x, hold->center->center.y);
+	if (center->site == CASTLE) {
+		printf("Its capital is the castle of %s located at %f, %f\n", name_string(&worldmap->names, center->name), center->center.x, center->center.y);
 	}
-	printf("The villages of %s are\n", hold->name.c_str());
-	for (const auto fief : hold->lands) {
+	printf("The villages of %s are\n", name_string(&worldmap->names, hold->name));
+	for (uint32_t index : hold->lands) {
+		const struct tile *fief = &worldmap->tiles[index];
 		if (fief->site == VILLAGE) {
-			printf("%s\n", fief->name.c_str());
+			printf("%s\n", name_string(&worldmap->names, fief->name));
 		}
 	}
 	printf("The neighboring holds are\n");
-	for (const auto neighbor : hold->neighbors) {
-		printf("%s\n", neighbor->name.c_str());
+	for (uint32_t neighbor : hold->neighbors) {
+		printf("%s\n", name_string(&worldmap->names, worldmap->holdings[neighbor].name));
 	}
 }
 
@@ -247,8 +267,8 @@ void land_navmesh(const Worldmap *worldmap)
 	for (const auto &c : worldmap->corners) {
 		bool walkable = false;
 		if (c.wall) {
-			for (const auto &t : c.touches) {
-				if (t->relief == LOWLAND || t->relief == HIGHLAND) {
+			for (uint32_t t : worldmap->graph.touches[c.index]) {
+				if (worldmap->tiles[t].relief == LOWLAND || worldmap->tiles[t].relief == HIGHLAND) {
 					walkable = true;
 				}
 			}
@@ -260,8 +280,8 @@ void land_navmesh(const Worldmap *worldmap)
 			marked[c.index] = true;
 		} else if (c.frontier == true) {
 			bool land = false;
-			for (const auto &t : c.touches) {
-				if (t->land) { land = true; }
+			for (uint32_t t : worldmap->graph.touches[c.index]) {
+				if (worldmap->tiles[t].land) { land = true; }
 			}
 			if (land == true && c.wall == false) {
 				points.push_back(c.position);
@@ -281,22 +301,31 @@ void land_navmesh(const Worldmap *worldmap)
 	}
 
 	// make river polygons
-	std::map<std::pair<uint32_t, uint32_t>, size_t> tilevertex;
+	// the vertex between a tile and each of its corners, parallel to the corner links of the tile
+	const struct adjacency &tilecorners = worldmap->graph.corners;
+	std::vector<size_t> tilevertex(tilecorners.links.size(), 0);
+	auto vertex_of = [&](uint32_t tile, uint32_t corner) -> size_t {
+		const struct span polygon = tilecorners[tile];
+		size_t i = std::find(polygon.begin(), polygon.end(), corner) - polygon.begin();
+		return i < polygon.size() ? tilevertex[tilecorners.offsets[tile] + i] : 0;
+	};
 	for (const auto &t : worldmap->tiles) {
-		for (const auto &c : t.corners) {
-			if (c->river) {
-				glm::vec2 vertex = segment_midpoint(t.center, c->position);
+		const struct span polygon = tilecorners[t.index];
+		for (size_t i = 0; i < polygon.size(); i++) {
+			const struct corner &corn = worldmap->corners[polygon[i]];
+			if (corn.river) {
+				glm::vec2 vertex = segment_midpoint(t.center, corn.position);
 				points.push_back(vertex);
-				tilevertex[std::minmax(t.index, c->index)] = index++;
+				tilevertex[tilecorners.offsets[t.index] + i] = index++;
 			}
 		}
 	}
 	for (const auto &b : worldmap->borders) {
 		if (b.river) {
-			size_t left_t0 = tilevertex[std::minmax(b.t0->index, b.c0->index)];
-			size_t right_t0 = tilevertex[std::minmax(b.t0->index, b.c1->index)];
-			size_t left_t1 = tilevertex[std::minmax(b.t1->index, b.c0->index)];
-			size_t right_t1 = tilevertex[std::minmax(b.t1->index, b.c1->index)];
+			size_t left_t0 = vertex_of(b.t0, b.c0);
+			size_t right_t0 = vertex_of(b.t0, b.c1);
+			size_t left_t1 = vertex_of(b.t1, b.c0);
+			size_t right_t1 = vertex_of(b.t1, b.c1);
 			struct customedge edge;
 			edge.vertices = std::make_pair(left_t0, right_t0);
 			edges.push_back(edge);
@@ -307,14 +336,16 @@ void land_navmesh(const Worldmap *worldmap)
 	std::unordered_map<uint32_t, bool> marked_edges;
 	std::unordered_map<uint32_t, size_t> edge_vertices;
 	for (const auto &b : worldmap->borders) {
-		bool half_river = b.c0->river ^ b.c1->river;
+		const struct corner &c0 = worldmap->corners[b.c0];
+		const struct corner &c1 = worldmap->corners[b.c1];
+		bool half_river = c0.river ^ c1.river;
 		marked_edges[b.index] = half_river;
 		if (half_river) {
-			glm::vec2 vertex = segment_midpoint(b.c0->position, b.c1->position);
+			glm::vec2 vertex = segment_midpoint(c0.position, c1.position);
 			points.push_back(vertex);
 			edge_vertices[b.index] = index++;
-		} else if (b.river == false && b.c0->river && b.c1->river) {
-			glm::vec2 vertex = segment_midpoint(b.c0->position, b.c1->position);
+		} else if (b.river == false && c0.river && c1.river) {
+			glm::vec2 vertex = segment_midpoint(c0.position, c1.position);
 			points.push_back(vertex);
 			edge_vertices[b.index] = index++;
 			marked_edges[b.index] = true;
@@ -322,17 +353,18 @@ void land_navmesh(const Worldmap *worldmap)
 	}
 	for (const auto &t : worldmap->tiles) {
 		if (t.land) {
-		for (const auto &b : t.borders) {
+		for (uint32_t bindex : worldmap->graph.borders[t.index]) {
+			const struct border *b = &worldmap->borders[bindex];
 			if (marked_edges[b->index] == true) {
-				if (b->c0->river) {
-					size_t left = tilevertex[std::minmax(t.index, b->c0->index)];
+				if (worldmap->corners[b->c0].river) {
+					size_t left = vertex_of(t.index, b->c0);
 					size_t right = edge_vertices[b->index];
 					struct customedge edge;
 					edge.vertices = std::make_pair(left, right);
 					edges.push_back(edge);
 				}
-				if (b->c1->river) {
-					size_t left = tilevertex[std::minmax(t.index, b->c1->index)];
+				if (worldmap->corners[b->c1].river) {
+					size_t left = vertex_of(t.index, b->c1);
 					size_t right = edge_vertices[b->index];
 					struct customedge edge;
 					edge.vertices = std::make_pair(left, right);
@@ -344,9 +376,9 @@ void land_navmesh(const Worldmap *worldmap)
 	}
 	for (const auto &b : worldmap->borders) {
 		if (b.coast) {
-			bool half_river = b.c0->river ^ b.c1->river;
+			bool half_river = worldmap->corners[b.c0].river ^ worldmap->corners[b.c1].river;
 			if (half_river) {
-				uint32_t index = (b.c0->river == false) ? b.c0->index : b.c1->index; 
+				uint32_t index = (worldmap->corners[b.c0].river == false) ? b.c0 : b.c1; 
 				size_t left = umap[index];
 				size_t right = edge_vertices[b.index];
 				struct customedge edge;
@@ -358,21 +390,23 @@ void land_navmesh(const Worldmap *worldmap)
 
 	// add coast and mountain edges
 	for (const auto &b : worldmap->borders) {
-		size_t left = umap[b.c0->index];
-		size_t right = umap[b.c1->index];
-		if (marked[b.c0->index] == true && marked[b.c1->index] == true) {
+		size_t left = umap[b.c0];
+		size_t right = umap[b.c1];
+		const struct tile &t0 = worldmap->tiles[b.t0];
+		const struct tile &t1 = worldmap->tiles[b.t1];
+		if (marked[b.c0] == true && marked[b.c1] == true) {
 			if (b.coast == true) {
 				struct customedge edge;
 				edge.vertices = std::make_pair(left, right);
 				edges.push_back(edge);
 			} else if (b.wall == true) {
-				if (b.t0->relief == HIGHLAND ^ b.t1->relief == HIGHLAND) {
+				if (t0.relief == HIGHLAND ^ t1.relief == HIGHLAND) {
 					struct customedge edge;
 					edge.vertices = std::make_pair(left, right);
 					edges.push_back(edge);
 				}
 			} else if (b.frontier == true) {
-				if (b.t0->land == true && b.t1->land == true) {
+				if (t0.land == true && t1.land == true) {
 					struct customedge edge;
 					edge.vertices = std::make_pair(left, right);
 					edges.push_back(edge);
@@ -447,13 +481,24 @@ int main(int argc, char *argv[])
 	Worldmap worldmap = {MAP_AREA};
 	worldmap.generate(seed);
 	printf("saving world\n");
-	serializer.save(&worldmap, filepath);
+	// the world is written in the background while the image and navmesh are made
+	std::future<bool> saving = serializer.save_async(&worldmap, filepath, [](const struct worlddata *snapshot) {
+		bool flat = save_worldfile(snapshot, "saves/world.bin");
+		bool pack = save_worldpack(snapshot, "saves/world.pack");
+		return flat && pack;
+	});
 
 	/*
 	serializer.load(filepath);
 	worldmap.tiles = serializer.tiles;
 	worldmap.corners = serializer.corners;
 	worldmap.borders = serializer.borders;
+	worldmap.graph = serializer.graph;
+	worldmap.bodies = serializer.bodies;
+	worldmap.branches = serializer.branches;
+	worldmap.basins = serializer.basins;
+	worldmap.holdings = serializer.holdings;
+	worldmap.names = serializer.names;
 	*/
 
 	auto end = std::chrono::steady_clock::now();
@@ -461,9 +506,14 @@ int main(int argc, char *argv[])
 	std::cout << "elapsed time: " << elapsed_seconds.count() << "s\n";
 
 	print_image(&worldmap);
-	//print_hold(&worldmap.holdings.front());
+	//print_hold(&worldmap, &worldmap.holdings.front());
 	//print_cultures(&worldmap);
 	land_navmesh(&worldmap);
 
+	if (!saving.get()) {
+		fprintf(stderr, "could not save world\n");
+		return 1;
+	}
+
 	return 0;
 }
@@ -0,0 +1,405 @@
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include "extern/namegen.h"
+
+#include "parallel.h"
+#include "random.h"
+#include "naming.h"
+
+// names generated in a single parallel job
+#define NAME_BATCH 256
+#define INITIAL_SLOTS 64
+
+// a bracket group of the pattern while it is being compiled
+struct patterngroup {
+	bool symbol; // <> group, otherwise a () group where everything is literal
+	std::vector<enum NAME_OPERATION> wrappers; // pending for the next operand, the last one is applied first
+	std::vector<std::vector<uint32_t>> alternatives; // operand sequences split by |
+};
+
+static uint32_t emit_literal(struct namepattern *compiled, const std::string &text)
+{
+	struct nameop op = { NAME_LITERAL, uint32_t(compiled->literals.size()), uint32_t(text.size()) };
+	compiled->literals.append(text);
+	compiled->operations.push_back(op);
+
+	return compiled->operations.size() - 1;
+}
+
+static uint32_t emit_operation(struct namepattern *compiled, enum NAME_OPERATION operation, const std::vector<uint32_t> &operands)
+{
+	struct nameop op = { operation, uint32_t(compiled->operands.size()), uint32_t(operands.size()) };
+	compiled->operands.insert(compiled->operands.end(), operands.begin(), operands.end());
+	compiled->operations.push_back(op);
+
+	return compiled->operations.size() - 1;
+}
+
+// runs of literals in the sequence are joined into a single literal
+static uint32_t emit_sequence(struct namepattern *compiled, const std::vector<uint32_t> &items)
+{
+	std::vector<uint32_t> operands;
+	std::vector<uint32_t> run;
+	auto flush = [&](void) {
+		if (run.size() == 1) {
+			operands.push_back(run.front());
+		} else if (run.size() > 1) {
+			std::string text;
+			for (uint32_t item : run) {
+				const struct nameop op = compiled->operations[item];
+				text.append(compiled->literals, op.first, op.count);
+			}
+			operands.push_back(emit_literal(compiled, text));
+		}
+		run.clear();
+	};
+
+	for (uint32_t item : items) {
+		if (compiled->operations[item].operation == NAME_LITERAL) {
+			run.push_back(item);
+		} else {
+			flush();
+			operands.push_back(item);
+		}
+	}
+	flush();
+
+	if (operands.empty()) { return emit_literal(compiled, ""); }
+	if (operands.size() == 1) { return operands.front(); }
+
+	return emit_operation(compiled, NAME_SEQUENCE, operands);
+}
+
+static uint32_t emit_choice(struct namepattern *compiled, const std::vector<uint32_t> &options)
+{
+	if (options.empty()) { return emit_literal(compiled, ""); }
+	if (options.size() == 1) { return options.front(); }
+
+	return emit_operation(compiled, NAME_CHOICE, options);
+}
+
+static void group_add(struct namepattern *compiled, struct patterngroup *group, uint32_t operand)
+{
+	while (!group->wrappers.empty()) {
+		operand = emit_operation(compiled, group->wrappers.back(), {operand});
+		group->wrappers.pop_back();
+	}
+	if (group->alternatives.empty()) {
+		group->alternatives.emplace_back();
+	}
+	group->alternatives.back().push_back(operand);
+}
+
+static uint32_t group_produce(struct namepattern *compiled, const struct patterngroup *group)
+{
+	std::vector<uint32_t> options;
+	for (const auto &alternative : group->alternatives) {
+		options.push_back(emit_sequence(compiled, alternative));
+	}
+
+	return emit_choice(compiled, options);
+}
+
+bool compile_pattern(const std::string &pattern, struct namepattern *compiled)
+{
+	compiled->operations.clear();
+	compiled->operands.clear();
+	compiled->literals.clear();
+	compiled->maxlength = 0;
+
+	const auto &symbols = NameGen::Generator::SymbolMap();
+	std::unordered_map<char, uint32_t> symbolchoices; // every symbol is only emitted once
+
+	std::vector<struct patterngroup> stack;
+	stack.push_back({true, {}, {}});
+
+	for (char c : pattern) {
+		struct patterngroup *top = &stack.back();
+		switch (c) {
+		case '<':
+		case '(':
+			stack.push_back({c == '<', {}, {}});
+			break;
+		case '>':
+		case ')': {
+			if (stack.size() < 2 || top->symbol != (c == '>')) {
+				return false;
+			}
+			uint32_t operand = group_produce(compiled, top);
+			stack.pop_back();
+			group_add(compiled, &stack.back(), operand);
+			break;
+		}
+		case '|':
+			if (top->alternatives.empty()) {
+				top->alternatives.emplace_back();
+			}
+			top->alternatives.emplace_back();
+			break;
+		case '!':
+		case '~':
+			if (top->symbol) {
+				top->wrappers.push_back(c == '!' ? NAME_CAPITALIZE : NAME_REVERSE);
+				break;
+			}
+			group_add(compiled, top, emit_literal(compiled, std::string(1, c)));
+			break;
+		default: {
+			auto symbol = symbols.find(std::string(1, c));
+			if (!top->symbol || symbol == symbols.end()) {
+				group_add(compiled, top, emit_literal(compiled, std::string(1, c)));
+				break;
+			}
+			auto cached = symbolchoices.find(c);
+			if (cached == symbolchoices.end()) {
+				std::vector<uint32_t> options;
+				for (const auto &text : symbol->second) {
+					options.push_back(emit_literal(compiled, text));
+				}
+				cached = symbolchoices.insert({c, emit_choice(compiled, options)}).first;
+			}
+			group_add(compiled, top, cached->second);
+			break;
+		}
+		}
+	}
+
+	if (stack.size() != 1) {
+		return false;
+	}
+
+	// like NameGen the whole name is wrapped in a collapser for tripled letters
+	emit_operation(compiled, NAME_COLLAPSE, {group_produce(compiled, &stack.back())});
+
+	// operands come first so the lengths can be found in one forward pass
+	std::vector<size_t> lengths(compiled->operations.size(), 0);
+	for (size_t i = 0; i < compiled->operations.size(); i++) {
+		const struct nameop *op = &compiled->operations[i];
+		const uint32_t *operands = compiled->operands.data() + op->first;
+		switch (op->operation) {
+		case NAME_LITERAL:
+			lengths[i] = op->count;
+			break;
+		case NAME_SEQUENCE:
+			for (uint32_t j = 0; j < op->count; j++) { lengths[i] += lengths[operands[j]]; }
+			break;
+		case NAME_CHOICE:
+			for (uint32_t j = 0; j < op->count; j++) { lengths[i] = std::max(lengths[i], lengths[operands[j]]); }
+			break;
+		default:
+			lengths[i] = lengths[operands[0]];
+			break;
+		}
+	}
+	compiled->maxlength = lengths.back();
+
+	return true;
+}
+
+void load_pattern(const char *fpath, struct namepattern *compiled)
+{
+	std::string pattern;
+
+	FILE *fp = fopen(fpath, "r");
+	if (fp) {
+		int c;
+		while ((c = fgetc(fp)) != EOF) {
+			if (c != '\n') {
+				pattern.append(1, c);
+			}
+		}
+		fclose(fp);
+	} else {
+		perror("File opening failed");
+	}
+
+	if (!fp || !compile_pattern(pattern, compiled)) {
+		if (fp) { fprintf(stderr, "Malformed name pattern in %s\n", fpath); }
+		compile_pattern("(failure)", compiled);
+	}
+}
+
+// drops letters repeated more often than in a believable name
+// vowels and soft letters may not be doubled, other letters may not be tripled
+static size_t collapse_repeats(char *name, size_t length)
+{
+	size_t out = 0;
+	int repeats = 0;
+	char previous = '\0';
+	for (size_t i = 0; i < length; i++) {
+		char c = name[i];
+		repeats = c == previous ? repeats + 1 : 0;
+		int limit = strchr("ahijquvwxy", c) ? 1 : 2;
+		if (repeats < limit) {
+			name[out++] = c;
+		}
+		previous = c;
+	}
+
+	return out;
+}
+
+// writes the output of an operation after the first length chars of the name and returns the new length
+// the choices take consecutive draws from the stream of the name
+static size_t expand(const struct namepattern *pattern, uint32_t index, uint64_t stream, uint64_t *draw, char *name, size_t length)
+{
+	const struct nameop *op = &pattern->operations[index];
+	const uint32_t *operands = pattern->operands.data() + op->first;
+	const size_t start = length;
+
+	switch (op->operation) {
+	case NAME_LITERAL:
+		memcpy(name + length, pattern->literals.data() + op->first, op->count);
+		return length + op->count;
+	case NAME_SEQUENCE:
+		for (uint32_t i = 0; i < op->count; i++) {
+			length = expand(pattern, operands[i], stream, draw, name, length);
+		}
+		return length;
+	case NAME_CHOICE: {
+		uint64_t bits = splitmix64(stream, (*draw)++);
+		uint32_t pick = ((bits >> 32) * op->count) >> 32;
+		return expand(pattern, operands[pick], stream, draw, name, length);
+	}
+	case NAME_CAPITALIZE:
+		length = expand(pattern, operands[0], stream, draw, name, length);
+		if (length > start) {
+			name[start] = toupper((unsigned char)name[start]);
+		}
+		return length;
+	case NAME_REVERSE:
+		length = expand(pattern, operands[0], stream, draw, name, length);
+		std::reverse(name + start, name + length);
+		return length;
+	case NAME_COLLAPSE:
+		length = expand(pattern, operands[0], stream, draw, name, length);
+		return start + collapse_repeats(name + start, length - start);
+	}
+
+	return length;
+}
+
+// FNV-1a
+static uint64_t hash_name(const char *name, size_t length)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static void place_slot(std::vector<uint32_t> &slots, uint64_t hash, uint32_t handle)
+{
+	const size_t mask = slots.size() - 1;
+	size_t i = hash & mask;
+	while (slots[i] != NO_NAME) {
+		i = (i + 1) & mask;
+	}
+	slots[i] = handle;
+}
+
+static void grow_slots(struct namepool *pool)
+{
+	std::vector<uint32_t> slots(2 * pool->slots.size(), NO_NAME);
+	for (uint32_t handle : pool->slots) {
+		if (handle != NO_NAME) {
+			const char *name = name_string(pool, handle);
+			place_slot(slots, hash_name(name, strlen(name)), handle);
+		}
+	}
+	pool->slots.swap(slots);
+}
+
+void reset_names(struct namepool *pool)
+{
+	pool->chars.clear();
+	pool->slots.assign(INITIAL_SLOTS, NO_NAME);
+	pool->count = 0;
+
+	intern_name(pool, "unnamed", strlen("unnamed"));
+}
+
+bool adopt_names(struct namepool *pool, const char *chars, size_t size)
+{
+	if (size == 0 || chars[size-1] != '\0') {
+		reset_names(pool);
+		return false;
+	}
+	pool->chars.assign(chars, chars + size);
+
+	pool->count = 0;
+	for (size_t i = 0; i < size; i++) {
+		if (chars[i] == '\0') { pool->count++; }
+	}
+	size_t slots = INITIAL_SLOTS;
+	while (slots < 2 * (pool->count + 1)) {
+		slots *= 2;
+	}
+	pool->slots.assign(slots, NO_NAME);
+	for (size_t handle = 0; handle < size; ) {
+		size_t length = strlen(chars + handle);
+		place_slot(pool->slots, hash_name(chars + handle, length), handle);
+		handle += length + 1;
+	}
+
+	return true;
+}
+
+uint32_t intern_name(struct namepool *pool, const char *name, size_t length)
+{
+	if (pool->slots.empty()) {
+		reset_names(pool);
+	}
+	// keep the table at most half full
+	if (2 * (pool->count + 1) > pool->slots.size()) {
+		grow_slots(pool);
+	}
+
+	const size_t mask = pool->slots.size() - 1;
+	for (size_t i = hash_name(name, length) & mask; ; i = (i + 1) & mask) {
+		uint32_t handle = pool->slots[i];
+		if (handle == NO_NAME) {
+			handle = pool->chars.size();
+			pool->chars.insert(pool->chars.end(), name, name + length);
+			pool->chars.push_back('\0');
+			pool->slots[i] = handle;
+			pool->count++;
+			return handle;
+		}
+		const char *stored = name_string(pool, handle);
+		if (strncmp(stored, name, length) == 0 && stored[length] == '\0') {
+			return handle;
+		}
+	}
+}
+
+void generate_names(const struct namepattern *pattern, uint64_t seed, uint64_t stage, const std::vector<uint32_t> &keys, struct namepool *pool, std::vector<uint32_t> &handles)
+{
+	// every name gets a slot wide enough for the longest possible name
+	const size_t stride = pattern->maxlength + 1;
+	const uint32_t root = pattern->operations.size() - 1;
+	std::vector<char> scratch(keys.size() * stride);
+	std::vector<size_t> lengths(keys.size());
+
+	parallel_for(keys.size(), NAME_BATCH, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			uint64_t draw = 0;
+			lengths[i] = expand(pattern, root, random_bits(seed, stage, keys[i]), &draw, &scratch[i * stride], 0);
+		}
+	});
+
+	// interned serially so the handles don't depend on the workers
+	handles.resize(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		handles[i] = intern_name(pool, &scratch[i * stride], lengths[i]);
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * naming - compiled name patterns and interned name strings
+ */
+
+enum NAME_OPERATION : uint8_t {
+	NAME_LITERAL,
+	NAME_SEQUENCE,
+	NAME_CHOICE,
+	NAME_CAPITALIZE,
+	NAME_REVERSE,
+	NAME_COLLAPSE
+};
+
+struct nameop {
+	enum NAME_OPERATION operation;
+	uint32_t first; // first char in the literals or first operand in the operands
+	uint32_t count; // number of chars or operands
+};
+
+// a NameGen pattern compiled into a flat table of operations
+// operands always come before the operation that uses them so the last operation is the root
+struct namepattern {
+	std::vector<struct nameop> operations;
+	std::vector<uint32_t> operands;
+	std::string literals;
+	size_t maxlength = 0; // longest name the pattern can produce
+};
+
+// compiles a pattern in the NameGen syntax, returns false if the pattern is malformed
+bool compile_pattern(const std::string &pattern, struct namepattern *compiled);
+
+// reads and compiles the pattern in a file, falls back to a pattern that only produces "failure"
+void load_pattern(const char *fpath, struct namepattern *compiled);
+
+#define UNNAMED 0
+#define NO_NAME 0xffffffff
+
+// names are stored back to back with their terminators in one buffer
+// a name is referred to by the offset of its first char and every distinct name is only stored once
+struct namepool {
+	std::vector<char> chars;
+	std::vector<uint32_t> slots; // open addressing table of the stored names
+	uint32_t count = 0;
+};
+
+// empties the pool down to "unnamed" at UNNAMED
+void reset_names(struct namepool *pool);
+
+// takes over the names of a saved pool, chars has to be the whole buffer with every terminator
+// returns false and resets the pool if it isn't
+bool adopt_names(struct namepool *pool, const char *chars, size_t size);
+
+// returns the handle of the name, storing it if it isn't in the pool yet
+uint32_t intern_name(struct namepool *pool, const char *name, size_t length);
+
+inline const char *name_string(const struct namepool *pool, uint32_t handle)
+{
+	return pool->chars.data() + handle;
+}
+
+// generates a name for each key in parallel and interns them, handles is filled parallel to keys
+// a name only depends on the seed, the stage and its key
+void generate_names(const struct namepattern *pattern, uint64_t seed, uint64_t stage, const std::vector<uint32_t> &keys, struct namepool *pool, std::vector<uint32_t> &handles);
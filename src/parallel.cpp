@@ -0,0 +1,146 @@
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "parallel.h"
+
+struct batch {
+	const std::function<void(size_t, size_t)> *job = nullptr;
+	size_t count = 0;
+	size_t grain = 1;
+	size_t nchunks = 0;
+	std::atomic<size_t> next;
+};
+
+struct pool {
+	std::mutex mutex;
+	std::mutex dispatch; // only one loop can use the workers at a time
+	std::condition_variable wake;
+	std::condition_variable finished;
+	std::vector<std::thread> workers;
+	unsigned int requested = 0;
+	unsigned long generation = 0;
+	unsigned int active = 0;
+	bool shutdown = false;
+	struct batch current;
+	~pool(void);
+};
+
+static struct pool POOL;
+static thread_local bool inside_job = false;
+
+static void run_chunks(struct batch *work)
+{
+	inside_job = true;
+	while (true) {
+		size_t chunk = work->next.fetch_add(1);
+		if (chunk >= work->nchunks) { break; }
+		size_t begin = chunk * work->grain;
+		size_t end = std::min(begin + work->grain, work->count);
+		(*work->job)(begin, end);
+	}
+	inside_job = false;
+}
+
+static void work_loop(unsigned long seen)
+{
+	while (true) {
+		std::unique_lock<std::mutex> lock(POOL.mutex);
+		POOL.wake.wait(lock, [&seen]{ return POOL.shutdown || POOL.generation != seen; });
+		if (POOL.shutdown) { return; }
+		seen = POOL.generation;
+		lock.unlock();
+
+		run_chunks(&POOL.current);
+
+		lock.lock();
+		if (--POOL.active == 0) {
+			POOL.finished.notify_all();
+		}
+	}
+}
+
+static void stop_workers(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(POOL.mutex);
+		POOL.shutdown = true;
+	}
+	POOL.wake.notify_all();
+	for (auto &worker : POOL.workers) {
+		worker.join();
+	}
+	POOL.workers.clear();
+	POOL.shutdown = false;
+}
+
+static void start_workers(unsigned int count)
+{
+	// the thread calling parallel_for is a worker too
+	for (unsigned int i = 1; i < count; i++) {
+		POOL.workers.push_back(std::thread(work_loop, POOL.generation));
+	}
+}
+
+pool::~pool(void)
+{
+	stop_workers();
+}
+
+void set_worker_count(unsigned int count)
+{
+	std::lock_guard<std::mutex> guard(POOL.dispatch);
+
+	POOL.requested = count;
+	stop_workers();
+}
+
+unsigned int worker_count(void)
+{
+	if (POOL.requested > 0) { return POOL.requested; }
+
+	unsigned int hardware = std::thread::hardware_concurrency();
+
+	return hardware > 0 ? hardware : 1;
+}
+
+void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)> &job)
+{
+	if (count == 0) { return; }
+	if (grain == 0) { grain = 1; }
+
+	// nested loops or single chunk loops are not worth waking up the workers for
+	if (inside_job || count <= grain || worker_count() < 2) {
+		for (size_t begin = 0; begin < count; begin += grain) {
+			job(begin, std::min(begin + grain, count));
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(POOL.dispatch);
+
+	if (POOL.workers.empty()) {
+		start_workers(worker_count());
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(POOL.mutex);
+		POOL.current.job = &job;
+		POOL.current.count = count;
+		POOL.current.grain = grain;
+		POOL.current.nchunks = (count + grain - 1) / grain;
+		POOL.current.next = 0;
+		POOL.active = POOL.workers.size();
+		POOL.generation++;
+	}
+	POOL.wake.notify_all();
+
+	run_chunks(&POOL.current);
+
+	std::unique_lock<std::mutex> lock(POOL.mutex);
+	POOL.finished.wait(lock, []{ return POOL.active == 0; });
+}
@@ -0,0 +1,14 @@
+/*
+ * parallel - persistent worker pool for data parallel loops
+ */
+
+// sets the number of threads used by parallel loops, 0 means one per hardware thread
+void set_worker_count(unsigned int count);
+
+unsigned int worker_count(void);
+
+// splits the range [0, count) into chunks of at most grain elements and calls job(begin, end) for each chunk
+// chunks are handed out dynamically so uneven chunks still balance across the workers
+// the calling thread works along and the function only returns once every chunk is done
+// nested calls from inside a job run serially on the calling thread
+void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)> &job);
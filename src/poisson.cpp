@@ -0,0 +1,161 @@
+#include <vector>
+#include <random>
+#include <cmath>
+#include <functional>
+#include <glm/glm.hpp>
+
+#include "parallel.h"
+#include "random.h"
+#include "poisson.h"
+
+// width of a sampling tile in grid cells, a tile has to be at least twice the radius wide
+#define TILE_CELLS 8
+#define TAU 6.28318530717958647692F
+
+struct samplegrid {
+	glm::vec2 min;
+	glm::vec2 max;
+	float radius;
+	float cellsize; // at most one sample fits in a cell
+	int width;
+	int height;
+	std::vector<int> cells; // index of the sample in the cell, -1 if empty
+	std::vector<glm::vec2> samples; // samples stored in the cell order
+};
+
+static inline int cell_index(const struct samplegrid *grid, glm::vec2 p)
+{
+	int x = std::min(int((p.x - grid->min.x) / grid->cellsize), grid->width - 1);
+	int y = std::min(int((p.y - grid->min.y) / grid->cellsize), grid->height - 1);
+
+	return y * grid->width + x;
+}
+
+static bool fits(const struct samplegrid *grid, glm::vec2 p)
+{
+	if (p.x < grid->min.x || p.y < grid->min.y || p.x > grid->max.x || p.y > grid->max.y) {
+		return false;
+	}
+
+	int cx = std::min(int((p.x - grid->min.x) / grid->cellsize), grid->width - 1);
+	int cy = std::min(int((p.y - grid->min.y) / grid->cellsize), grid->height - 1);
+	if (grid->cells[cy * grid->width + cx] >= 0) { return false; }
+
+	const float r2 = grid->radius * grid->radius;
+	for (int y = std::max(cy - 2, 0); y <= std::min(cy + 2, grid->height - 1); y++) {
+		for (int x = std::max(cx - 2, 0); x <= std::min(cx + 2, grid->width - 1); x++) {
+			int sample = grid->cells[y * grid->width + x];
+			if (sample >= 0) {
+				glm::vec2 d = grid->samples[sample] - p;
+				if (glm::dot(d, d) < r2) { return false; }
+			}
+		}
+	}
+
+	return true;
+}
+
+// Bridson's algorithm confined to one tile, samples of neighboring tiles from earlier phases are respected
+static void sample_tile(struct samplegrid *grid, int tx, int ty, uint32_t attempts, long seed)
+{
+	const int tiles_x = (grid->width + TILE_CELLS - 1) / TILE_CELLS;
+	// decorrelates the random stream of each tile from its neighbors
+	std::mt19937_64 gen(splitmix64(seed, ty * tiles_x + tx));
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	const int x0 = tx * TILE_CELLS;
+	const int y0 = ty * TILE_CELLS;
+	const int x1 = std::min(x0 + TILE_CELLS, grid->width);
+	const int y1 = std::min(y0 + TILE_CELLS, grid->height);
+	const glm::vec2 lo = grid->min + grid->cellsize * glm::vec2(x0, y0);
+	const glm::vec2 hi = glm::min(grid->min + grid->cellsize * glm::vec2(x1, y1), grid->max);
+
+	auto inside = [&](glm::vec2 p) {
+		int cx = (p.x - grid->min.x) / grid->cellsize;
+		int cy = (p.y - grid->min.y) / grid->cellsize;
+		return p.x >= lo.x && p.y >= lo.y && p.x <= hi.x && p.y <= hi.y && cx >= x0 && cx < x1 && cy >= y0 && cy < y1;
+	};
+
+	std::vector<glm::vec2> active;
+	auto add = [&](glm::vec2 p) {
+		// the sample index is the cell index so the grid never has to grow while other tiles read it
+		int cell = cell_index(grid, p);
+		grid->samples[cell] = p;
+		grid->cells[cell] = cell;
+		active.push_back(p);
+	};
+
+	// darts thrown into the tile start new fronts, they also fill gaps fronts from the neighbors could not reach
+	for (uint32_t dart = 0; dart < attempts; dart++) {
+		glm::vec2 p = lo + glm::vec2(unit(gen), unit(gen)) * (hi - lo);
+		if (!inside(p) || !fits(grid, p)) { continue; }
+		add(p);
+
+		while (!active.empty()) {
+			std::uniform_int_distribution<size_t> pick(0, active.size() - 1);
+			size_t chosen = pick(gen);
+			glm::vec2 center = active[chosen];
+			bool found = false;
+			for (uint32_t attempt = 0; attempt < attempts; attempt++) {
+				float angle = TAU * unit(gen);
+				float distance = grid->radius * std::sqrt(1.f + 3.f * unit(gen));
+				glm::vec2 candidate = center + distance * glm::vec2(std::cos(angle), std::sin(angle));
+				if (inside(candidate) && fits(grid, candidate)) {
+					add(candidate);
+					found = true;
+					break;
+				}
+			}
+			if (!found) {
+				active[chosen] = active.back();
+				active.pop_back();
+			}
+		}
+	}
+}
+
+std::vector<glm::vec2> poisson_disk_sample(float radius, glm::vec2 min, glm::vec2 max, uint32_t attempts, long seed)
+{
+	std::vector<glm::vec2> points;
+	if (!(radius > 0.f) || attempts == 0 || !(min.x < max.x) || !(min.y < max.y)) {
+		return points;
+	}
+
+	struct samplegrid grid;
+	grid.min = min;
+	grid.max = max;
+	grid.radius = radius;
+	grid.cellsize = radius / std::sqrt(2.f);
+	grid.width = std::ceil((max.x - min.x) / grid.cellsize);
+	grid.height = std::ceil((max.y - min.y) / grid.cellsize);
+	grid.cells.assign(grid.width * grid.height, -1);
+	grid.samples.resize(grid.width * grid.height);
+
+	const int tiles_x = (grid.width + TILE_CELLS - 1) / TILE_CELLS;
+	const int tiles_y = (grid.height + TILE_CELLS - 1) / TILE_CELLS;
+	const int phase_x = (tiles_x + 1) / 2;
+	const int phase_y = (tiles_y + 1) / 2;
+
+	// a 2x2 coloring of the tiles, every tile of a phase is a full tile away from the others
+	for (int phase = 0; phase < 4; phase++) {
+		const int ox = phase % 2;
+		const int oy = phase / 2;
+		parallel_for(phase_x * phase_y, 1, [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				int tx = 2 * (i % phase_x) + ox;
+				int ty = 2 * (i / phase_x) + oy;
+				if (tx < tiles_x && ty < tiles_y) {
+					sample_tile(&grid, tx, ty, attempts, seed);
+				}
+			}
+		});
+	}
+
+	for (size_t i = 0; i < grid.cells.size(); i++) {
+		if (grid.cells[i] >= 0) {
+			points.push_back(grid.samples[i]);
+		}
+	}
+
+	return points;
+}
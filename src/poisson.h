@@ -0,0 +1,8 @@
+/*
+ * poisson - parallel Poisson disk sampling
+ */
+
+// returns points inside [min, max] that are never closer than radius to each other
+// the area is split into square tiles sampled in four phases, tiles in the same phase are too far apart to interact
+// so they are sampled concurrently, each tile has its own random stream so the result only depends on the seed
+std::vector<glm::vec2> poisson_disk_sample(float radius, glm::vec2 min, glm::vec2 max, uint32_t attempts, long seed);
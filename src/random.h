@@ -0,0 +1,32 @@
+/*
+ * random - counter based random numbers
+ */
+
+// output n of a SplitMix64 generator started at seed, computed straight from the counter
+inline uint64_t splitmix64(uint64_t seed, uint64_t n)
+{
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (n + 1);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
+
+// random bits that only depend on the seed, the stage and the index of the draw
+// every stage gets its own stream so stages can't disturb each other
+inline uint64_t random_bits(uint64_t seed, uint64_t stage, uint64_t index)
+{
+	return splitmix64(splitmix64(seed, stage), index);
+}
+
+// uniform float in [0, 1)
+inline float random_unit(uint64_t seed, uint64_t stage, uint64_t index)
+{
+	return (random_bits(seed, stage, index) >> 40) * (1.f / 16777216.f);
+}
+
+// true with probability p
+inline bool random_chance(uint64_t seed, uint64_t stage, uint64_t index, float p)
+{
+	return random_unit(seed, stage, index) < p;
+}
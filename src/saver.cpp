@@ -1,10 +1,14 @@
 
+#include <cstdio>
 #include <string>
 #include <vector>
 #include <list>
 #include <iostream>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <functional>
+#include <future>
 
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
@@ -19,6 +23,9 @@
 
 #include "geom.h"
 #include "imp.h"
+#include "graph.h"
+#include "components.h"
+#include "naming.h"
 #include "voronoi.h"
 #include "terra.h"
 #include "worldmap.h"
@@ -43,13 +50,13 @@ struct tile_record {
 	uint8_t relief;
 	uint8_t biome;
 	uint8_t site;
-	//std::string name;
+	uint32_t name = UNNAMED;
 	int32_t holding = -1;
 
 	template <class Archive>
 	void serialize(Archive &ar)
 	{
-		ar(CEREAL_NVP(index), CEREAL_NVP(frontier), CEREAL_NVP(land), CEREAL_NVP(coast), CEREAL_NVP(river), CEREAL_NVP(center_x), CEREAL_NVP(center_y), CEREAL_NVP(neighbors), CEREAL_NVP(corners), CEREAL_NVP(borders), CEREAL_NVP(relief), CEREAL_NVP(biome), CEREAL_NVP(site), CEREAL_NVP(holding));
+		ar(CEREAL_NVP(index), CEREAL_NVP(frontier), CEREAL_NVP(land), CEREAL_NVP(coast), CEREAL_NVP(river), CEREAL_NVP(center_x), CEREAL_NVP(center_y), CEREAL_NVP(neighbors), CEREAL_NVP(corners), CEREAL_NVP(borders), CEREAL_NVP(relief), CEREAL_NVP(biome), CEREAL_NVP(site), CEREAL_NVP(name), CEREAL_NVP(holding));
 	}
 };
 
@@ -90,8 +97,40 @@ struct border_record {
 		ar(CEREAL_NVP(index), CEREAL_NVP(c0), CEREAL_NVP(c1), CEREAL_NVP(t0), CEREAL_NVP(t1), CEREAL_NVP(frontier), CEREAL_NVP(coast), CEREAL_NVP(river), CEREAL_NVP(wall));
 	}
 };
+
+// river branches as parallel arrays of their fields so each one is a single block in the archive
+struct river_record {
+	std::vector<uint32_t> confluence;
+	std::vector<uint32_t> parent;
+	std::vector<uint32_t> left;
+	std::vector<uint32_t> right;
+	std::vector<int32_t> streamorder;
+	std::vector<int32_t> depth;
+	std::vector<uint32_t> basin_first;
+	std::vector<uint32_t> basin_mouth;
+	template <class Archive>
+	void serialize(Archive &ar)
+	{
+		ar(CEREAL_NVP(confluence), CEREAL_NVP(parent), CEREAL_NVP(left), CEREAL_NVP(right), CEREAL_NVP(streamorder), CEREAL_NVP(depth), CEREAL_NVP(basin_first), CEREAL_NVP(basin_mouth));
+	}
+};
+
+// holdings with their lands and neighbors in compressed sparse row form
+struct holding_record {
+	std::vector<uint32_t> center;
+	std::vector<uint32_t> name;
+	std::vector<uint32_t> land_offsets = {0};
+	std::vector<uint32_t> lands;
+	std::vector<uint32_t> neighbor_offsets = {0};
+	std::vector<uint32_t> neighbors;
+	template <class Archive>
+	void serialize(Archive &ar)
+	{
+		ar(CEREAL_NVP(center), CEREAL_NVP(name), CEREAL_NVP(land_offsets), CEREAL_NVP(lands), CEREAL_NVP(neighbor_offsets), CEREAL_NVP(neighbors));
+	}
+};
 	
-void WorldSerializer::save(const Worldmap *world, const std::string &filepath)
+static bool write_world(const struct worlddata *world, const std::string &filepath)
 {
 	uint32_t tilecount = world->tiles.size();
 	uint32_t cornercount = world->corners.size();
@@ -99,6 +138,8 @@ void WorldSerializer::save(const Worldmap *world, const std::string &filepath)
 	std::vector<struct tile_record> tile_records;
 	std::vector<struct corner_record> corner_records;
 	std::vector<struct border_record> border_records;
+	struct river_record rivers;
+	struct holding_record holds;
 
 	// the tiles
 	for (const auto &til : world->tiles) {
@@ -107,26 +148,24 @@ void WorldSerializer::save(const Worldmap *world, const std::string &filepath)
 		record.frontier = til.frontier;
 		record.land = til.land;
 		record.coast = til.coast;
+		record.river = til.river;
 		record.center_x = til.center.x;
 		record.center_y = til.center.y;
-		for (const auto &neighbor : til.neighbors) {
-			record.neighbors.push_back(neighbor->index);
+		for (uint32_t neighbor : world->graph.neighbors[til.index]) {
+			record.neighbors.push_back(neighbor);
 		}
-		for (const auto &corner : til.corners) {
-			record.corners.push_back(corner->index);
+		for (uint32_t corner : world->graph.corners[til.index]) {
+			record.corners.push_back(corner);
 		}
-		for (const auto &border : til.borders) {
-			record.borders.push_back(border->index);
+		for (uint32_t border : world->graph.borders[til.index]) {
+			record.borders.push_back(border);
 		}
 		//record.amp = til.amp;
 		record.relief = uint8_t(til.relief);
 		record.biome = uint8_t(til.biome);
 		record.site = uint8_t(til.site);
-		if (til.hold) {
-			record.holding = til.hold->index;
-		} else {
-			record.holding = -1;
-		}
+		record.name = til.name;
+		record.holding = til.hold;
 		//
 		tile_records.push_back(record);
 	}
@@ -137,11 +176,11 @@ void WorldSerializer::save(const Worldmap *world, const std::string &filepath)
 		record.index = corn.index;
 		record.position_x = corn.position.x;
 		record.position_y = corn.position.y;
-		for (const auto &adj : corn.adjacent) {
-			record.adjacent.push_back(adj->index);
+		for (uint32_t adj : world->graph.adjacent[corn.index]) {
+			record.adjacent.push_back(adj);
 		}
-		for (const auto &til : corn.touches) {
-			record.touches.push_back(til->index);
+		for (uint32_t til : world->graph.touches[corn.index]) {
+			record.touches.push_back(til);
 		}
 		// world data
 		record.frontier = corn.frontier;
@@ -157,10 +196,10 @@ void WorldSerializer::save(const Worldmap *world, const std::string &filepath)
 	for (const auto &bord : world->borders) {
 		struct border_record record;
 		record.index = bord.index;
-		record.c0 = bord.c0->index;
-		record.c1 = bord.c1->index;
-		record.t0 = bord.t0->index;
-		record.t1 = bord.t1->index;
+		record.c0 = bord.c0;
+		record.c1 = bord.c1;
+		record.t0 = bord.t0;
+		record.t1 = bord.t1;
 		// world data
 		record.frontier = bord.frontier;
 		record.coast = bord.coast;
@@ -170,9 +209,37 @@ void WorldSerializer::save(const Worldmap *world, const std::string &filepath)
 		border_records.push_back(record);
 	}
 
+	// the rivers
+	for (const auto &node : world->branches) {
+		rivers.confluence.push_back(node.confluence);
+		rivers.parent.push_back(node.parent);
+		rivers.left.push_back(node.left);
+		rivers.right.push_back(node.right);
+		rivers.streamorder.push_back(node.streamorder);
+		rivers.depth.push_back(node.depth);
+	}
+	for (const auto &basin : world->basins) {
+		rivers.basin_first.push_back(basin.first);
+		rivers.basin_mouth.push_back(basin.mouth);
+	}
+
+	// the holdings
+	for (const auto &hold : world->holdings) {
+		holds.center.push_back(hold.center);
+		holds.name.push_back(hold.name);
+		holds.lands.insert(holds.lands.end(), hold.lands.begin(), hold.lands.end());
+		holds.land_offsets.push_back(holds.lands.size());
+		holds.neighbors.insert(holds.neighbors.end(), hold.neighbors.begin(), hold.neighbors.end());
+		holds.neighbor_offsets.push_back(holds.neighbors.size());
+	}
+
 	//std::ofstream os(filepath);
 	//cereal::JSONOutputArchive archive(os);
 	std::ofstream os(filepath, std::ios::binary);
+	if (!os) {
+		perror(filepath.c_str());
+		return false;
+	}
 	cereal::BinaryOutputArchive archive(os);
 
 	archive(
@@ -182,8 +249,40 @@ void WorldSerializer::save(const Worldmap *world, const std::string &filepath)
 		cereal::make_nvp("bordercount", bordercount), 
 		cereal::make_nvp("tiles", tile_records),
 		cereal::make_nvp("corners", corner_records),
-		cereal::make_nvp("corners", border_records)
+		cereal::make_nvp("corners", border_records),
+		cereal::make_nvp("rivers", rivers),
+		cereal::make_nvp("holdings", holds),
+		cereal::make_nvp("names", world->names.chars),
+		cereal::make_nvp("body_labels", world->bodies.label),
+		cereal::make_nvp("body_sizes", world->bodies.size)
 	);
+
+	os.flush();
+	if (!os) {
+		fprintf(stderr, "%s: write failed\n", filepath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool WorldSerializer::save(const struct worlddata *world, const std::string &filepath)
+{
+	return write_world(world, filepath);
+}
+
+std::future<bool> WorldSerializer::save_async(const struct worlddata *world, const std::string &filepath, std::function<bool(const struct worlddata *snapshot)> done)
+{
+	// the copy is the only part on the caller's thread, building the records and writing happen in the background
+	std::shared_ptr<const struct worlddata> snapshot = std::make_shared<const struct worlddata>(*world);
+
+	return std::async(std::launch::async, [snapshot, filepath, done]() {
+		bool saved = write_world(snapshot.get(), filepath);
+		if (saved && done) {
+			saved = done(snapshot.get());
+		}
+		return saved;
+	});
 }
 	
 void WorldSerializer::load(const std::string &filepath)
@@ -191,6 +290,11 @@ void WorldSerializer::load(const std::string &filepath)
 	tiles.clear();
 	corners.clear();
 	borders.clear();
+	clear_adjacency(&graph.neighbors);
+	clear_adjacency(&graph.corners);
+	clear_adjacency(&graph.borders);
+	clear_adjacency(&graph.adjacent);
+	clear_adjacency(&graph.touches);
 
 	uint32_t tilecount = 0;
 	uint32_t cornercount = 0;
@@ -198,6 +302,9 @@ void WorldSerializer::load(const std::string &filepath)
 	std::vector<struct tile_record> tile_records;
 	std::vector<struct corner_record> corner_records;
 	std::vector<struct border_record> border_records;
+	struct river_record rivers;
+	struct holding_record holds;
+	std::vector<char> namechars;
 
 	std::ifstream is(filepath, std::ios::binary);
 	cereal::BinaryInputArchive archive(is);
@@ -209,7 +316,12 @@ void WorldSerializer::load(const std::string &filepath)
 		cereal::make_nvp("bordercount", bordercount), 
 		cereal::make_nvp("tiles", tile_records),
 		cereal::make_nvp("corners", corner_records),
-		cereal::make_nvp("corners", border_records)
+		cereal::make_nvp("corners", border_records),
+		cereal::make_nvp("rivers", rivers),
+		cereal::make_nvp("holdings", holds),
+		cereal::make_nvp("names", namechars),
+		cereal::make_nvp("body_labels", bodies.label),
+		cereal::make_nvp("body_sizes", bodies.size)
 	);
 
 	tiles.resize(tilecount);
@@ -217,28 +329,28 @@ void WorldSerializer::load(const std::string &filepath)
 	borders.resize(bordercount);
 
 	// the tiles
+	// records are saved in index order so their links can be appended as adjacency rows
 	for (const auto &record : tile_records) {
 		struct tile til;
 		til.index = record.index;
 		til.frontier = record.frontier;
 		til.land = record.land;
 		til.coast = record.coast;
+		til.river = record.river;
 		til.center.x = record.center_x;
 		til.center.y = record.center_y;
-		for (const auto &neighbor : record.neighbors) {
-			til.neighbors.push_back(&tiles[neighbor]);
-		}
-		for (const auto &corner : record.corners) {
-			til.corners.push_back(&corners[corner]);
-		}
-		for (const auto &border : record.borders) {
-			til.borders.push_back(&borders[border]);
-		}
+		graph.neighbors.links.insert(graph.neighbors.links.end(), record.neighbors.begin(), record.neighbors.end());
+		end_node(&graph.neighbors);
+		graph.corners.links.insert(graph.corners.links.end(), record.corners.begin(), record.corners.end());
+		end_node(&graph.corners);
+		graph.borders.links.insert(graph.borders.links.end(), record.borders.begin(), record.borders.end());
+		end_node(&graph.borders);
 		//record.amp = til.amp;
 		til.relief = static_cast<enum RELIEF>(record.relief);
 		til.biome = static_cast<enum BIOME>(record.biome);
 		til.site = static_cast<enum SITE>(record.site);
-		til.hold = nullptr;
+		til.name = record.name;
+		til.hold = record.holding;
 		//
 		tiles[til.index] = til;
 	}
@@ -249,12 +361,10 @@ void WorldSerializer::load(const std::string &filepath)
 		corn.index = record.index;
 		corn.position.x = record.position_x;
 		corn.position.y = record.position_y;
-		for (const auto &adj : record.adjacent) {
-			corn.adjacent.push_back(&corners[adj]);
-		}
-		for (const auto &index : record.touches) {
-			corn.touches.push_back(&tiles[index]);
-		}
+		graph.adjacent.links.insert(graph.adjacent.links.end(), record.adjacent.begin(), record.adjacent.end());
+		end_node(&graph.adjacent);
+		graph.touches.links.insert(graph.touches.links.end(), record.touches.begin(), record.touches.end());
+		end_node(&graph.touches);
 		// world data
 		corn.frontier = record.frontier;
 		corn.coast = record.coast;
@@ -269,10 +379,10 @@ void WorldSerializer::load(const std::string &filepath)
 	for (const auto &record : border_records) {
 		struct border bord;
 		bord.index = record.index;
-		bord.c0 = &corners[record.c0];
-		bord.c1 = &corners[record.c1];
-		bord.t0 = &tiles[record.t0];
-		bord.t1 = &tiles[record.t1];
+		bord.c0 = record.c0;
+		bord.c1 = record.c1;
+		bord.t0 = record.t0;
+		bord.t1 = record.t1;
 		// world data
 		bord.frontier = record.frontier;
 		bord.coast = record.coast;
@@ -282,5 +392,37 @@ void WorldSerializer::load(const std::string &filepath)
 		borders[bord.index] = bord;
 	}
 
+	link_borders(&graph, borders);
+
+	// the rivers
+	branches.resize(rivers.confluence.size());
+	for (size_t i = 0; i < branches.size(); i++) {
+		struct branch &node = branches[i];
+		node.confluence = rivers.confluence[i];
+		node.parent = rivers.parent[i];
+		node.left = rivers.left[i];
+		node.right = rivers.right[i];
+		node.streamorder = rivers.streamorder[i];
+		node.depth = rivers.depth[i];
+	}
+	basins.resize(rivers.basin_first.size());
+	for (size_t i = 0; i < basins.size(); i++) {
+		basins[i].first = rivers.basin_first[i];
+		basins[i].mouth = rivers.basin_mouth[i];
+	}
+
+	// the holdings
+	holdings.resize(holds.center.size());
+	for (size_t i = 0; i < holdings.size(); i++) {
+		struct holding &hold = holdings[i];
+		hold.index = i;
+		hold.center = holds.center[i];
+		hold.name = holds.name[i];
+		hold.lands.assign(holds.lands.begin() + holds.land_offsets[i], holds.lands.begin() + holds.land_offsets[i+1]);
+		hold.neighbors.assign(holds.neighbors.begin() + holds.neighbor_offsets[i], holds.neighbors.begin() + holds.neighbor_offsets[i+1]);
+	}
+
+	adopt_names(&names, namechars.data(), namechars.size());
+
 	std::cout << seed << std::endl;
 }
@@ -4,10 +4,19 @@ public:
 	std::vector<struct tile> tiles;
 	std::vector<struct corner> corners;
 	std::vector<struct border> borders;
-	//std::list<struct basin> basins;
-	//std::list<struct holding> holdings;
+	struct worldgraph graph;
+	struct components bodies;
+	std::vector<struct branch> branches;
+	std::vector<struct basin> basins;
+	std::vector<struct holding> holdings;
+	struct namepool names;
 	long seed;
 public:
 	void load(const std::string &filepath);
-	void save(const Worldmap *world, const std::string &filepath);
+	// returns false if the file couldn't be written
+	bool save(const struct worlddata *world, const std::string &filepath);
+	// copies the world and writes the copy on a background thread so the world can be used or changed right away
+	// once the write succeeded done is called on that thread with the copy, so other formats can be written from it too
+	// the future holds false if the write or done failed, done isn't called if the write failed
+	std::future<bool> save_async(const struct worlddata *world, const std::string &filepath, std::function<bool(const struct worlddata *snapshot)> done = nullptr);
 };
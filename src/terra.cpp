@@ -2,12 +2,16 @@
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <functional>
+#include <chrono>
 
+#include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "extern/FastNoise.h"
 
 #include "imp.h"
+#include "parallel.h"
 #include "terra.h"
 
 #define RAIN_FREQUENCY 0.01F
@@ -18,116 +22,377 @@
 #define RAIN_GAUSS_CENTER 0.25F
 #define RAIN_GAUSS_SIGMA 0.25F
 #define RAIN_DETAIL_MIX 0.5F
+// number of image rows evaluated in a single parallel job
+#define BAND_ROWS 16
+// number of image columns blurred and mixed in a single parallel job, a block row fills a cache line
+#define BLUR_BLOCK_COLUMNS 16
+// number of points evaluated in a single parallel job in sampled mode
+#define SAMPLE_BATCH 1024
+// the sampled mode approximates the blurred land mask on a grid this many times coarser than the images
+#define MOISTURE_GRID_SCALE 4
 
-static struct byteimage heightimage(size_t imageres, long seed, struct worldparams params)
+static void height_noise(FastNoise *noise, long seed, const struct worldparams *params)
 {
-	struct byteimage image = blank_byteimage(1, imageres, imageres);
+	noise->SetSeed(seed);
+	noise->SetNoiseType(FastNoise::SimplexFractal);
+	noise->SetFractalType(FastNoise::FBM);
+	noise->SetFrequency(params->frequency);
+	noise->SetPerturbFrequency(params->perturbfreq);
+	noise->SetFractalOctaves(params->octaves);
+	noise->SetFractalLacunarity(params->lacunarity);
+	noise->SetGradientPerturbAmp(params->perturbamp);
+}
 
-	FastNoise noise;
-	noise.SetSeed(seed);
-	noise.SetNoiseType(FastNoise::SimplexFractal);
-	noise.SetFractalType(FastNoise::FBM);
-	noise.SetFrequency(params.frequency);
-	noise.SetPerturbFrequency(params.perturbfreq);
-	noise.SetFractalOctaves(params.octaves);
-	noise.SetFractalLacunarity(params.lacunarity);
-	noise.SetGradientPerturbAmp(params.perturbamp);
+static void temperature_noise(FastNoise *noise, long seed, const struct worldparams *params)
+{
+	noise->SetSeed(seed);
+	noise->SetNoiseType(FastNoise::Perlin);
+	noise->SetFrequency(params->tempfreq);
+	noise->SetPerturbFrequency(2.f*params->tempfreq);
+	noise->SetGradientPerturbAmp(params->tempperturb);
+}
+
+static void rain_noise(FastNoise *noise, long seed)
+{
+	noise->SetSeed(seed);
+	noise->SetNoiseType(FastNoise::Perlin);
+	noise->SetFrequency(RAIN_FREQUENCY);
+	noise->SetFractalOctaves(RAIN_OCTAVES);
+	noise->SetFractalLacunarity(RAIN_LACUNARITY);
+	noise->SetPerturbFrequency(RAIN_PERTURB_FREQUENCY);
+	noise->SetGradientPerturbAmp(RAIN_PERTURB_AMP);
+}
+
+// The parameter a is the height of the curve's peak, b is the position of the center of the peak and c (the standard deviation, sometimes called the Gaussian RMS width) controls the width of the "bell".
+static inline float gauss(float a, float b, float c, float x)
+{
+	float exponent = ((x-b)*(x-b)) / (2.f * (c*c));
+
+	return a * std::exp(-exponent);
+}
+
+// maps [0, 1] to the full 16 bit range
+static inline unsigned short quantize(float value)
+{
+	return 65535.f * glm::clamp(value, 0.f, 1.f) + 0.5f;
+}
+
+// the evaluators below take pixel coordinates (column x, row y) and overwrite them while perturbing
+// they are shared by the raster images and the point queries so both modes produce the same pixel values
+
+static void eval_height(const FastNoise *noise, std::vector<float> &x, std::vector<float> &y, unsigned short *out)
+{
+	const int count = x.size();
+	std::vector<float> height(count);
+	for (int k = 0; k < count; k++) {
+		x[k] *= 4.f; y[k] *= 4.f;
+	}
+	noise->GradientPerturbFractalSet(x.data(), y.data(), count);
+	noise->GetNoiseSet(x.data(), y.data(), height.data(), count);
+	for (int k = 0; k < count; k++) {
+		float h = (height[k] + 1.f) / 2.f;
+		out[k] = quantize(h);
+	}
+}
+
+static void eval_temperature(const FastNoise *noise, float longitude, std::vector<float> &x, std::vector<float> &y, unsigned short *out)
+{
+	const int count = x.size();
+	noise->GradientPerturbFractalSet(x.data(), y.data(), count);
+	for (int k = 0; k < count; k++) {
+		float temperature = 1.f - (y[k] / longitude);
+		out[k] = quantize(temperature);
+	}
+}
 
+// temperature and moisture are the already evaluated temperature and blurred land mask of the same pixels
+static void eval_rain(const FastNoise *noise, std::vector<float> &x, std::vector<float> &y, const unsigned short *temperature, const unsigned short *moisture, unsigned short *out)
+{
+	const int count = x.size();
+	std::vector<float> details(count);
+	noise->GradientPerturbFractalSet(x.data(), y.data(), count);
+	noise->GetNoiseSet(x.data(), y.data(), details.data(), count);
+	for (int k = 0; k < count; k++) {
+		float temp = 1.f - (temperature[k] / 65535.f);
+		float rain = 1.f - (moisture[k] / 65535.f);
+		float detail = (details[k] + 1.f) / 2.f;
+		float dev = gauss(1.f, RAIN_GAUSS_CENTER, RAIN_GAUSS_SIGMA, rain);
+		rain = glm::mix(rain, detail, RAIN_DETAIL_MIX*dev);
+		rain = glm::mix(rain, temp, detail*(1.f - temp));
+		out[k] = quantize(rain);
+	}
+}
+
+// fills the pixel coordinates of the rows [first, last)
+static void band_coordinates(size_t first, size_t last, size_t width, std::vector<float> &x, std::vector<float> &y)
+{
+	x.resize((last - first) * width);
+	y.resize((last - first) * width);
 	unsigned int index = 0;
-	for (int i = 0; i < image.width; i++) {
-		for (int j = 0; j < image.height; j++) {
-			float x = 4.f*j; float y = 4.f*i;
-			noise.GradientPerturbFractal(x, y);
-			float height = (noise.GetNoise(x, y) + 1.f) / 2.f;
-			image.data[index++] = 255 * glm::clamp(height, 0.f, 1.f);
+	for (int i = first; i < last; i++) {
+		for (int j = 0; j < width; j++) {
+			y[index] = i; x[index] = j;
+			index++;
 		}
 	}
+}
+
+static struct shortimage heightimage(size_t imageres, long seed, struct worldparams params)
+{
+	struct shortimage image = blank_shortimage(1, imageres, imageres);
+
+	FastNoise noise;
+	height_noise(&noise, seed, &params);
+
+	// every pixel only depends on its own coordinates so bands of rows can be evaluated in any order
+	parallel_for(image.height, BAND_ROWS, [&](size_t first, size_t last) {
+		std::vector<float> x, y;
+		band_coordinates(first, last, image.width, x, y);
+		eval_height(&noise, x, y, &image.data[first * image.width]);
+	});
 
 	return image;
 }
 
-static struct byteimage tempimage(size_t imageres, long seed, float freq, float perturb)
+static struct shortimage tempimage(size_t imageres, long seed, struct worldparams params)
 {
-	struct byteimage image = blank_byteimage(1, imageres, imageres);
+	struct shortimage image = blank_shortimage(1, imageres, imageres);
 
 	FastNoise noise;
-	noise.SetSeed(seed);
-	noise.SetNoiseType(FastNoise::Perlin);
-	noise.SetFrequency(freq);
-	noise.SetPerturbFrequency(2.f*freq);
-	noise.SetGradientPerturbAmp(perturb);
+	temperature_noise(&noise, seed, &params);
 
 	const float longitude = float(image.height);
-	unsigned int index = 0;
-	for (int i = 0; i < image.width; i++) {
-		for (int j = 0; j < image.height; j++) {
-			float y = i; float x = j;
-			noise.GradientPerturbFractal(x, y);
-			float temperature = 1.f - (y / longitude);
-			image.data[index++] = 255 * glm::clamp(temperature, 0.f, 1.f);
-		}
-	}
+	parallel_for(image.height, BAND_ROWS, [&](size_t first, size_t last) {
+		std::vector<float> x, y;
+		band_coordinates(first, last, image.width, x, y);
+		eval_temperature(&noise, longitude, x, y, &image.data[first * image.width]);
+	});
 
 	return image;
 }
 
-// The parameter a is the height of the curve's peak, b is the position of the center of the peak and c (the standard deviation, sometimes called the Gaussian RMS width) controls the width of the "bell".
-static inline float gauss(float a, float b, float c, float x)
+// fused pipeline: the land mask is thresholded while it is loaded into the horizontal blur pass
+// and the rain is mixed per column block right after its vertical pass while the block is still in cache
+static struct shortimage rainimage(const struct shortimage *elevation, const struct shortimage *temperature, long seed, float sealevel, float blur)
 {
-	float exponent = ((x-b)*(x-b)) / (2.f * (c*c));
+	const int width = elevation->width;
+	const int height = elevation->height;
+	struct shortimage image = blank_shortimage(1, width, height);
 
-	return a * std::exp(-exponent);
-}
+	struct gauss_kernel kernel = make_gauss_kernel(blur);
+	std::vector<float> mask(width * height);
 
-static struct byteimage rainimage(const struct byteimage *elevation, const struct byteimage *temperature, long seed, float sealevel, float blur)
-{
-	struct byteimage image = blank_byteimage(1, elevation->width, elevation->height);
+	parallel_for(height, BAND_ROWS, [&](size_t first, size_t last) {
+		for (int i = first; i < last; i++) {
+			const unsigned short *heights = &elevation->data[i*width];
+			float *row = &mask[i*width];
+			for (int j = 0; j < width; j++) {
+				row[j] = (heights[j] / 65535.f > sealevel) ? 65535.f : 0.f;
+			}
+			if (kernel.active) {
+				gauss_filter_line(&kernel, row, width, 1);
+			}
+		}
+	});
 
-	for (int i = 0; i < elevation->width*elevation->height; i++) {
-		float h = elevation->data[i] / 255.f;
-		if (h > sealevel) { 
-			h = 1.f; 
-		} else {
-			h = 0.f;
+	FastNoise noise;
+	rain_noise(&noise, seed);
+
+	parallel_for(width, BLUR_BLOCK_COLUMNS, [&](size_t first, size_t last) {
+		const int columns = last - first;
+		if (kernel.active) {
+			gauss_filter_block(&kernel, &mask[first], height, width, columns);
 		}
-		image.data[i] = h * 255;
-	}
 
-	gauss_blur_image(&image, blur);
+		const int count = columns * height;
+		std::vector<float> x(count), y(count);
+		std::vector<unsigned short> temps(count), moisture(count);
+		unsigned int index = 0;
+		for (int i = 0; i < height; i++) {
+			for (int j = first; j < last; j++) {
+				x[index] = j; y[index] = i;
+				temps[index] = temperature->data[i*width+j];
+				moisture[index] = glm::clamp(mask[i*width+j] + 0.5f, 0.f, 65535.f);
+				index++;
+			}
+		}
+
+		std::vector<unsigned short> rain(count);
+		eval_rain(&noise, x, y, temps.data(), moisture.data(), rain.data());
+
+		index = 0;
+		for (int i = 0; i < height; i++) {
+			for (int j = first; j < last; j++) {
+				image.data[i*width+j] = rain[index++];
+			}
+		}
+	});
+
+	return image;
+}
+
+// blurred land mask on a coarse grid, stands in for the first two passes of rainimage in sampled mode
+static struct shortimage moistureimage(size_t imageres, long seed, struct worldparams params)
+{
+	const size_t res = imageres / MOISTURE_GRID_SCALE;
+	struct shortimage image = blank_shortimage(1, res, res);
 
 	FastNoise noise;
-	noise.SetSeed(seed);
-	noise.SetNoiseType(FastNoise::Perlin);
-	noise.SetFrequency(RAIN_FREQUENCY);
-	noise.SetFractalOctaves(RAIN_OCTAVES);
-	noise.SetFractalLacunarity(RAIN_LACUNARITY);
-	noise.SetPerturbFrequency(RAIN_PERTURB_FREQUENCY);
-	noise.SetGradientPerturbAmp(RAIN_PERTURB_AMP);
-
-	for (int i = 0; i < image.width; i++) {
-		for (int j = 0; j < image.height; j++) {
-			int index = i * image.width + j;
-			float temp = 1.f - (temperature->data[index] / 255.f);
-			float rain = 1.f - (image.data[index] / 255.f);
-			float y = i; float x = j;
-			noise.GradientPerturbFractal(x, y);
-			float detail = (noise.GetNoise(x, y) + 1.f) / 2.f;
-			float dev = gauss(1.f, RAIN_GAUSS_CENTER, RAIN_GAUSS_SIGMA, rain);
-			rain = glm::mix(rain, detail, RAIN_DETAIL_MIX*dev);
-			rain = glm::mix(rain, temp, detail*(1.f - temp));
-			image.data[index] = glm::clamp(rain, 0.f, 1.f) * 255;
+	height_noise(&noise, seed, &params);
+
+	parallel_for(image.height, BAND_ROWS, [&](size_t first, size_t last) {
+		std::vector<float> x, y;
+		band_coordinates(first, last, image.width, x, y);
+		for (int k = 0; k < x.size(); k++) {
+			x[k] *= MOISTURE_GRID_SCALE;
+			y[k] *= MOISTURE_GRID_SCALE;
 		}
-	}
+		unsigned short *band = &image.data[first * image.width];
+		eval_height(&noise, x, y, band);
+		for (int k = 0; k < x.size(); k++) {
+			band[k] = (band[k] / 65535.f > params.lowland) ? 65535 : 0;
+		}
+	});
+
+	gauss_blur_shortimage(&image, params.rainblur / MOISTURE_GRID_SCALE);
 
 	return image;
 }
 
-struct terraform form_terra(size_t imageres, long seed, struct worldparams params)
+// bilinear lookup of the coarse moisture grid at image space pixel coordinates
+static unsigned short sample_moisture(const struct shortimage *moisture, float x, float y)
+{
+	float u = x / MOISTURE_GRID_SCALE;
+	float v = y / MOISTURE_GRID_SCALE;
+	int x0 = glm::clamp(int(u), 0, int(moisture->width) - 1);
+	int y0 = glm::clamp(int(v), 0, int(moisture->height) - 1);
+	int x1 = std::min(x0 + 1, int(moisture->width) - 1);
+	int y1 = std::min(y0 + 1, int(moisture->height) - 1);
+	float s = glm::clamp(u - x0, 0.f, 1.f);
+	float t = glm::clamp(v - y0, 0.f, 1.f);
+
+	float top = glm::mix(float(moisture->data[y0*moisture->width+x0]), float(moisture->data[y0*moisture->width+x1]), s);
+	float bottom = glm::mix(float(moisture->data[y1*moisture->width+x0]), float(moisture->data[y1*moisture->width+x1]), s);
+
+	return glm::mix(top, bottom, t) + 0.5f;
+}
+
+struct terraform form_terra(size_t imageres, long seed, struct worldparams params, enum TERRA_MODE mode)
 {
 	struct terraform terra;
+	terra.mode = mode;
+	terra.resolution = imageres;
+	terra.seed = seed;
+	terra.params = params;
+
+	if (mode == TERRA_SAMPLED) {
+		// height and temperature are evaluated on demand by sample_terra
+		auto start = std::chrono::steady_clock::now();
+		terra.moisture = moistureimage(imageres, seed, params);
+		auto end = std::chrono::steady_clock::now();
+		std::chrono::duration<double> elapsed_seconds = end-start;
+		std::cout << "moisture grid elapsed time: " << elapsed_seconds.count() << "s\n";
+
+		return terra;
+	}
+
+	auto start = std::chrono::steady_clock::now();
 	terra.heightmap = heightimage(imageres, seed, params);
-	terra.tempmap = tempimage(imageres, seed, params.tempfreq, params.tempperturb);
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed_seconds = end-start;
+	std::cout << "heightmap elapsed time: " << elapsed_seconds.count() << "s\n";
+
+	start = std::chrono::steady_clock::now();
+	terra.tempmap = tempimage(imageres, seed, params);
+	end = std::chrono::steady_clock::now();
+	elapsed_seconds = end-start;
+	std::cout << "tempmap elapsed time: " << elapsed_seconds.count() << "s\n";
+
+	start = std::chrono::steady_clock::now();
 	terra.rainmap = rainimage(&terra.heightmap, &terra.tempmap, seed, params.lowland, params.rainblur);
+	end = std::chrono::steady_clock::now();
+	elapsed_seconds = end-start;
+	std::cout << "rainmap elapsed time: " << elapsed_seconds.count() << "s\n";
 
 	return terra;
 }
+
+void sample_terra(const struct terraform *terra, const std::vector<glm::vec2> &points, std::vector<float> *height, std::vector<float> *temperature, std::vector<float> *rain)
+{
+	const size_t count = points.size();
+	if (height) { height->resize(count); }
+	if (temperature) { temperature->resize(count); }
+	if (rain) { rain->resize(count); }
+
+	if (terra->mode == TERRA_RASTER) {
+		parallel_for(count, SAMPLE_BATCH, [&](size_t first, size_t last) {
+			for (int i = first; i < last; i++) {
+				const glm::vec2 &p = points[i];
+				if (height) { (*height)[i] = sample_shortimage(p.x, p.y, RED, &terra->heightmap); }
+				if (temperature) { (*temperature)[i] = sample_shortimage(p.x, p.y, RED, &terra->tempmap); }
+				if (rain) { (*rain)[i] = sample_shortimage(p.x, p.y, RED, &terra->rainmap); }
+			}
+		});
+		return;
+	}
+
+	FastNoise heightnoise, tempnoise, rainnoise;
+	height_noise(&heightnoise, terra->seed, &terra->params);
+	temperature_noise(&tempnoise, terra->seed, &terra->params);
+	rain_noise(&rainnoise, terra->seed);
+
+	const int res = terra->resolution;
+	const float longitude = float(res);
+
+	parallel_for(count, SAMPLE_BATCH, [&](size_t first, size_t last) {
+		// snap to the pixel the raster images would have sampled, points outside the image read as 0
+		std::vector<int> inside;
+		std::vector<float> px, py;
+		for (int i = first; i < last; i++) {
+			int x = points[i].x;
+			int y = points[i].y;
+			if (x < 0 || y < 0 || x > res-1 || y > res-1) {
+				if (height) { (*height)[i] = 0.f; }
+				if (temperature) { (*temperature)[i] = 0.f; }
+				if (rain) { (*rain)[i] = 0.f; }
+			} else {
+				inside.push_back(i);
+				px.push_back(x);
+				py.push_back(y);
+			}
+		}
+
+		const int n = inside.size();
+		std::vector<float> x, y;
+		if (height) {
+			std::vector<unsigned short> values(n);
+			x = px; y = py;
+			eval_height(&heightnoise, x, y, values.data());
+			for (int k = 0; k < n; k++) {
+				(*height)[inside[k]] = values[k] / 65535.f;
+			}
+		}
+		if (temperature || rain) {
+			std::vector<unsigned short> temps(n);
+			x = px; y = py;
+			eval_temperature(&tempnoise, longitude, x, y, temps.data());
+			if (temperature) {
+				for (int k = 0; k < n; k++) {
+					(*temperature)[inside[k]] = temps[k] / 65535.f;
+				}
+			}
+			if (rain) {
+				std::vector<unsigned short> moisture(n);
+				std::vector<unsigned short> values(n);
+				for (int k = 0; k < n; k++) {
+					moisture[k] = sample_moisture(&terra->moisture, points[inside[k]].x, points[inside[k]].y);
+				}
+				x = px; y = py;
+				eval_rain(&rainnoise, x, y, temps.data(), moisture.data(), values.data());
+				for (int k = 0; k < n; k++) {
+					(*rain)[inside[k]] = values[k] / 65535.f;
+				}
+			}
+		}
+	});
+}
@@ -15,12 +15,31 @@ struct worldparams {
 	float upland;
 	float highland;
 	bool erodmountains;
+	// sites
+	bool hopspacing; // space sites by hops through the tile graph instead of by distance
+	// performance
+	unsigned int threads; // 0 uses every hardware thread
+	bool sampledterra; // evaluate terra per point instead of generating full images
+};
+
+enum TERRA_MODE {
+	TERRA_RASTER, // full resolution images are generated up front
+	TERRA_SAMPLED // noise is only evaluated at the queried points
 };
 
 struct terraform {
-	struct byteimage heightmap;
-	struct byteimage tempmap;
-	struct byteimage rainmap;
+	enum TERRA_MODE mode;
+	size_t resolution;
+	long seed;
+	struct worldparams params;
+	struct shortimage heightmap; // empty in sampled mode
+	struct shortimage tempmap; // empty in sampled mode
+	struct shortimage rainmap; // empty in sampled mode
+	struct shortimage moisture; // coarse blurred land mask, only used in sampled mode
 };
 
-struct terraform form_terra(size_t imageres, long seed, struct worldparams params);
+struct terraform form_terra(size_t imageres, long seed, struct worldparams params, enum TERRA_MODE mode);
+
+// samples height, temperature and rain in the [0, 1] range at image space points, pass nullptr to skip an output
+// both modes give the same height and temperature, sampled rain approximates the land mask blur on a coarser grid
+void sample_terra(const struct terraform *terra, const std::vector<glm::vec2> &points, std::vector<float> *height, std::vector<float> *temperature, std::vector<float> *rain);
@@ -3,6 +3,9 @@
 #include <vector>
 #include <algorithm>
 #include <set>
+#include <functional>
+#include <cmath>
+#include <cstring>
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 
@@ -14,17 +17,14 @@
 #define JCV_PI 3.141592653589793115997963468544185161590576171875
 #include "extern/jc_voronoi.h"
 
+#include "parallel.h"
+#include "graph.h"
 #include "voronoi.h"
 
-static void prune_vertices(std::vector<const struct vertex*> &v)
-{
-	auto end = v.end();
-	for (auto it = v.begin(); it != end; ++it) {
-		end = std::remove(it + 1, end, *it);
-	}
-
-	v.erase(end, v.end());
-}
+// sites whose centroids are computed in a single parallel job
+#define RELAX_BATCH 1024
+#define ARENA_ALIGNMENT 16
+#define ARENA_BLOCK_SIZE (1 << 20)
 
 // Remaps the point from the input space to image space
 static inline jcv_point remap(const jcv_point *pt, const jcv_point *min, const jcv_point *max, const jcv_point *scale)
@@ -36,153 +36,265 @@ static inline jcv_point remap(const jcv_point *pt, const jcv_point *min, const j
 	return p;
 }
 
-static void relax_points(const jcv_diagram *diagram, std::vector<jcv_point> &points)
+// bump allocator for jcv, its blocks are kept between diagrams so relaxations don't go back to malloc
+struct arena {
+	std::vector<char*> blocks;
+	std::vector<size_t> sizes;
+	size_t current = 0; // block that is being filled
+	size_t offset = 0; // first free byte in the current block
+	~arena(void)
+	{
+		for (char *block : blocks) { delete [] block; }
+	}
+};
+
+static void *arena_alloc(void *ctx, size_t size)
+{
+	struct arena *mem = (struct arena*)ctx;
+	size = (size + ARENA_ALIGNMENT - 1) & ~size_t(ARENA_ALIGNMENT - 1);
+
+	while (mem->current < mem->blocks.size()) {
+		if (mem->offset + size <= mem->sizes[mem->current]) {
+			void *p = mem->blocks[mem->current] + mem->offset;
+			mem->offset += size;
+			return p;
+		}
+		mem->current++;
+		mem->offset = 0;
+	}
+
+	size_t blocksize = std::max(size, size_t(ARENA_BLOCK_SIZE));
+	mem->blocks.push_back(new char[blocksize]);
+	mem->sizes.push_back(blocksize);
+	mem->offset = size;
+
+	return mem->blocks.back();
+}
+
+// memory is only released all at once by the arena
+static void arena_free(void *ctx, void *p) {}
+
+static void arena_reset(struct arena *mem)
+{
+	mem->current = 0;
+	mem->offset = 0;
+}
+
+static void generate(struct arena *mem, const std::vector<jcv_point> &points, const jcv_rect *rect, jcv_diagram *diagram)
+{
+	if (diagram->internal) {
+		jcv_diagram_free(diagram);
+		memset(diagram, 0, sizeof(jcv_diagram));
+	}
+	arena_reset(mem);
+
+	jcv_diagram_generate_useralloc(points.size(), points.data(), rect, 0, mem, arena_alloc, arena_free, diagram);
+	jcv_diagram_generate_vertices(diagram);
+}
+
+// moves each site to the centroid of its cell, sites with degenerate cells are dropped
+// returns the mean distance the remaining sites moved
+static double relax_points(const jcv_diagram *diagram, std::vector<jcv_point> &points)
 {
 	const jcv_site* sites = jcv_diagram_get_sites(diagram);
-	for( int i = 0; i < diagram->numsites; ++i ) {
-		const jcv_site* site = &sites[i];
-		jcv_point sum = site->p;
-		int count = 1;
 
-		const jcv_graphedge* edge = site->edges;
+	std::vector<jcv_point> centroids(diagram->numsites);
+	std::vector<uint8_t> valid(diagram->numsites, false); // not bool, workers write neighbouring flags at once
+	parallel_for(diagram->numsites, RELAX_BATCH, [&](size_t first, size_t last) {
+		for (int i = first; i < last; i++) {
+			const jcv_site* site = &sites[i];
+			jcv_point sum = site->p;
+			int count = 1;
 
-		glm::vec2 center = {site->p.x, site->p.y};
-		bool valid = true;
+			const jcv_graphedge* edge = site->edges;
 
-		while (edge) {
-			glm::vec2 a = {edge->pos[0].x, edge->pos[0].y};
-			glm::vec2 b = {edge->pos[1].x, edge->pos[1].y};
-			if (glm::distance(center, a) > 200.f) {
-				valid = false;
-			}
-			if (glm::distance(center, b) > 200.f) {
-				valid = false;
-			}
-			if (glm::distance(a, b) > 200.f) {
-				valid = false;
+			glm::vec2 center = {site->p.x, site->p.y};
+			bool fine = true;
+
+			while (edge) {
+				glm::vec2 a = {edge->pos[0].x, edge->pos[0].y};
+				glm::vec2 b = {edge->pos[1].x, edge->pos[1].y};
+				if (glm::distance(center, a) > 200.f) {
+					fine = false;
+				}
+				if (glm::distance(center, b) > 200.f) {
+					fine = false;
+				}
+				if (glm::distance(a, b) > 200.f) {
+					fine = false;
+				}
+				sum.x += edge->pos[0].x;
+				sum.y += edge->pos[0].y;
+				++count;
+				edge = edge->next;
 			}
-			sum.x += edge->pos[0].x;
-			sum.y += edge->pos[0].y;
-			++count;
-			edge = edge->next;
+
+			centroids[i].x = sum.x / count;
+			centroids[i].y = sum.y / count;
+			valid[i] = fine;
 		}
+	});
 
-		if (valid) {
-		jcv_point point;
-		point.x = sum.x / count;
-		point.y = sum.y / count;
-		points.push_back(point);
+	double displacement = 0.0;
+	points.clear();
+	for (int i = 0; i < diagram->numsites; i++) {
+		if (valid[i]) {
+			points.push_back(centroids[i]);
+			displacement += std::hypot(centroids[i].x - sites[i].p.x, centroids[i].y - sites[i].p.y);
 		}
 	}
+
+	return points.empty() ? 0.0 : displacement / points.size();
 }
 
-static void adapt_cells(const jcv_diagram *diagram, std::vector<struct cell> &cells)
+// turns per node counts into offsets, the counts are left as write cursors for the fill pass
+static void prefix_offsets(struct adjacency *graph, std::vector<uint32_t> &counts)
+{
+	graph->offsets.resize(counts.size() + 1);
+	graph->offsets[0] = 0;
+	for (size_t i = 0; i < counts.size(); i++) {
+		graph->offsets[i+1] = graph->offsets[i] + counts[i];
+		counts[i] = graph->offsets[i];
+	}
+	graph->links.resize(graph->offsets.back());
+}
+
+// the vertices of a cell polygon without duplicates, in the order they are first met
+static void polygon_vertices(const jcv_site *site, std::vector<uint32_t> &polygon)
+{
+	polygon.clear();
+	const jcv_graphedge *edge = site->edges;
+	while (edge) {
+		const jcv_altered_edge *altered = get_altered_edge(edge);
+		for (int i = 0; i < 2; i++) {
+			uint32_t index = altered->vertices[i]->index;
+			if (std::find(polygon.begin(), polygon.end(), index) == polygon.end()) {
+				polygon.push_back(index);
+			}
+		}
+		edge = edge->next;
+	}
+}
+
+static void adapt_cells(const jcv_diagram *diagram, std::vector<glm::vec2> &centers, struct adjacency *neighbors)
 {
 	const jcv_site *sites = jcv_diagram_get_sites(diagram);
 
-	// get each cell
+	centers.resize(diagram->numsites);
+	std::vector<uint32_t> counts(diagram->numsites, 0);
 	for (int i = 0; i < diagram->numsites; i++) {
 		const jcv_site *site = &sites[i];
-		struct cell cell;
-		jcv_point p = site->p;
-		cell.center = glm::vec2(p.x, p.y);
-		cell.index = site->index;
-		cells[site->index] = cell;
-	}
-	// get neighbor cells
-	for (int i = 0; i < diagram->numsites; i++) { 
+		centers[site->index] = glm::vec2(site->p.x, site->p.y);
+		for (const jcv_graphedge *edge = site->edges; edge; edge = edge->next) {
+			if (edge->neighbor != nullptr) { counts[site->index]++; }
+		}
+	}
+
+	prefix_offsets(neighbors, counts);
+
+	for (int i = 0; i < diagram->numsites; i++) {
 		const jcv_site *site = &sites[i];
-		const jcv_graphedge *edge = site->edges;
-		while (edge) {
-			const jcv_site *neighbor = edge->neighbor;
-			if (neighbor != nullptr) {
-				cells[site->index].neighbors.push_back(&cells[neighbor->index]);
+		for (const jcv_graphedge *edge = site->edges; edge; edge = edge->next) {
+			if (edge->neighbor != nullptr) {
+				neighbors->links[counts[site->index]++] = edge->neighbor->index;
 			}
-
-			edge = edge->next;
 		}
 	}
 }
 
-static void adapt_vertices(const jcv_diagram *diagram, std::vector<struct vertex> &vertices)
+static void adapt_vertices(const jcv_diagram *diagram, std::vector<glm::vec2> &positions, struct adjacency *adjacent)
 {
-	const jcv_site *sites = jcv_diagram_get_sites(diagram);
-	const jcv_vertex *vertex = jcv_diagram_get_vertices(diagram);
-	while (vertex) {
-		struct vertex c;
-		c.index = vertex->index;
-		c.position = glm::vec2(vertex->pos.x, vertex->pos.y);
-		jcv_vertex_edge *edges = vertex->edges;
-		while (edges) {
-			jcv_vertex *neighbor = edges->neighbor;
-			c.adjacent.push_back(&vertices[neighbor->index]);
-			edges = edges->next;
+	positions.resize(diagram->internal->numvertices);
+	std::vector<uint32_t> counts(positions.size(), 0);
+	for (const jcv_vertex *vertex = jcv_diagram_get_vertices(diagram); vertex; vertex = jcv_diagram_get_next_vertex(vertex)) {
+		positions[vertex->index] = glm::vec2(vertex->pos.x, vertex->pos.y);
+		for (const jcv_vertex_edge *edge = vertex->edges; edge; edge = edge->next) {
+			counts[vertex->index]++;
+		}
+	}
+
+	prefix_offsets(adjacent, counts);
+
+	for (const jcv_vertex *vertex = jcv_diagram_get_vertices(diagram); vertex; vertex = jcv_diagram_get_next_vertex(vertex)) {
+		for (const jcv_vertex_edge *edge = vertex->edges; edge; edge = edge->next) {
+			adjacent->links[counts[vertex->index]++] = edge->neighbor->index;
 		}
-		vertices[vertex->index] = c;
-		vertex = jcv_diagram_get_next_vertex(vertex);
 	}
 }
 
-static void pair_duality(const jcv_diagram *diagram, std::vector<struct cell> &cells, std::vector<struct vertex> &vertices)
+static void pair_duality(const jcv_diagram *diagram, size_t nvertices, struct adjacency *cell_vertices, struct adjacency *vertex_cells)
 {
 	const jcv_site *sites = jcv_diagram_get_sites(diagram);
 
-	// get vertex and cell duality
-	for (int i = 0; i < diagram->numsites; i++) { 
+	// count the polygon vertices of each cell and the cells touching each vertex
+	std::vector<uint32_t> polygon;
+	std::vector<uint32_t> counts(diagram->numsites, 0);
+	std::vector<uint32_t> touches(nvertices, 0);
+	for (int i = 0; i < diagram->numsites; i++) {
 		const jcv_site *site = &sites[i];
-		const jcv_graphedge *edge = site->edges;
-		while (edge) {
-			const jcv_altered_edge *altered = get_altered_edge(edge);
-			jcv_vertex *a = altered->vertices[0];
-			cells[site->index].vertices.push_back(&vertices[a->index]);
-			jcv_vertex *b = altered->vertices[1];
-			cells[site->index].vertices.push_back(&vertices[b->index]);
-
-			edge = edge->next;
+		polygon_vertices(site, polygon);
+		counts[site->index] = polygon.size();
+		for (uint32_t vertex : polygon) {
+			touches[vertex]++;
 		}
 	}
-	// remove duplicates and add duality
-	for (auto &cell : cells) {
-		prune_vertices(cell.vertices);
-		for (auto &vertex : cell.vertices) {
-			vertices[vertex->index].cells.push_back(&cells[cell.index]);
+
+	prefix_offsets(cell_vertices, counts);
+	prefix_offsets(vertex_cells, touches);
+
+	for (int i = 0; i < diagram->numsites; i++) {
+		const jcv_site *site = &sites[i];
+		polygon_vertices(site, polygon);
+		std::copy(polygon.begin(), polygon.end(), cell_vertices->links.begin() + counts[site->index]);
+	}
+	// add duality in cell order
+	for (size_t cell = 0; cell < cell_vertices->size(); cell++) {
+		for (uint32_t vertex : (*cell_vertices)[cell]) {
+			vertex_cells->links[touches[vertex]++] = cell;
 		}
 	}
 }
 
-static void adapt_edges(const jcv_diagram *diagram, std::vector<struct cell> &cells, std::vector<struct vertex> &vertices, std::vector<struct edge> &edges)
+static void adapt_edges(const jcv_diagram *diagram, std::vector<struct edge> &edges, struct adjacency *cell_edges)
 {
-	const jcv_edge *jcedge = jcv_diagram_get_edges(diagram);
-	while (jcedge) {
-		struct edge e;
+	size_t count = 0;
+	for (const jcv_edge *jcedge = jcv_diagram_get_edges(diagram); jcedge; jcedge = jcv_diagram_get_next_edge(jcedge)) {
+		count++;
+	}
+
+	edges.resize(count);
+	std::vector<uint32_t> counts(diagram->numsites, 0);
+	int index = 0;
+	for (const jcv_edge *jcedge = jcv_diagram_get_edges(diagram); jcedge; jcedge = jcv_diagram_get_next_edge(jcedge)) {
+		struct edge &e = edges[index];
+		e.index = index++;
 		if (jcedge->sites[0] != nullptr) {
-			e.c0 = &cells[jcedge->sites[0]->index];
+			e.c0 = jcedge->sites[0]->index;
+			counts[e.c0]++;
 		}
 		if (jcedge->sites[1] != nullptr) {
-			e.c1 = &cells[jcedge->sites[1]->index];
+			e.c1 = jcedge->sites[1]->index;
+			counts[e.c1]++;
 		}
 
-    		const jcv_altered_edge *alter = (jcv_altered_edge*)jcedge;
-		e.v0 = &vertices[alter->vertices[0]->index];
-		e.v1 = &vertices[alter->vertices[1]->index];
-
-		edges.push_back(e);
-		jcedge = jcv_diagram_get_next_edge(jcedge);
+		const jcv_altered_edge *alter = (const jcv_altered_edge*)jcedge;
+		e.v0 = alter->vertices[0]->index;
+		e.v1 = alter->vertices[1]->index;
 	}
 
-	for (int i = 0; i < edges.size(); i++) {
-		struct edge *e = &edges[i];
-		e->index = i;
-		if (e->c0 != nullptr) {
-			cells[e->c0->index].edges.push_back(&edges[i]);
+	prefix_offsets(cell_edges, counts);
+
+	for (const auto &e : edges) {
+		if (e.c0 >= 0) {
+			cell_edges->links[counts[e.c0]++] = e.index;
 		}
-		if (e->c1 != nullptr) {
-			cells[e->c1->index].edges.push_back(&edges[i]);
+		if (e.c1 >= 0) {
+			cell_edges->links[counts[e.c1]++] = e.index;
 		}
 	}
 }
 
-void Voronoi::gen_diagram(std::vector<glm::vec2> &locations, glm::vec2 min, glm::vec2 max, uint8_t relaxations)
+void Voronoi::gen_diagram(std::vector<glm::vec2> &locations, glm::vec2 min, glm::vec2 max, uint8_t relaxations, float tolerance)
 {
 	std::vector<jcv_point> points;
 	for (auto &location : locations) {
@@ -198,26 +310,23 @@ void Voronoi::gen_diagram(std::vector<glm::vec2> &locations, glm::vec2 min, glm:
 	};
 	jcv_diagram diagram;
 	memset(&diagram, 0, sizeof(jcv_diagram));
-	jcv_diagram_generate(points.size(), points.data(), &rect, 0, &diagram);
-	jcv_diagram_generate_vertices(&diagram);
+	struct arena mem;
+	generate(&mem, points, &rect, &diagram);
 
+	// Lloyd relaxation, stops early once the sites barely move
 	for (uint8_t i = 0; i < relaxations; i++) {
-		std::vector<jcv_point> relaxed_points;
-		relax_points(&diagram, relaxed_points);
-		jcv_diagram_generate(relaxed_points.size(), relaxed_points.data(), &rect, 0, &diagram);
-		jcv_diagram_generate_vertices(&diagram);
+		double displacement = relax_points(&diagram, points);
+		generate(&mem, points, &rect, &diagram);
+		if (displacement < tolerance) { break; }
 	}
 
-	cells.resize(diagram.numsites);
-	vertices.resize(diagram.internal->numvertices);
-
-	adapt_cells(&diagram, cells);
+	adapt_cells(&diagram, centers, &cell_neighbors);
 
-	adapt_vertices(&diagram, vertices);
+	adapt_vertices(&diagram, positions, &vertex_adjacent);
 
-	pair_duality(&diagram, cells, vertices);
+	pair_duality(&diagram, positions.size(), &cell_vertices, &vertex_cells);
 
-	adapt_edges(&diagram, cells, vertices, edges);
+	adapt_edges(&diagram, edges, &cell_edges);
 
 	jcv_diagram_free(&diagram);
 }
@@ -1,35 +1,24 @@
-struct cell;
-struct vertex;
-struct edge;
-
+// edge between two vertices, c0 or c1 is -1 if the edge lies on the bounds of the diagram
 struct edge {
 	int index;
-	const struct vertex *v0 = nullptr;
-	const struct vertex *v1 = nullptr;
-	const struct cell *c0 = nullptr;
-	const struct cell *c1 = nullptr;
-};
-
-struct vertex {
-	int index;
-	glm::vec2 position;
-	std::vector<const struct vertex*> adjacent;
-	std::vector<const struct cell*> cells;
-};
-
-struct cell {
-	int index;
-	glm::vec2 center;
-	std::vector<const struct cell*> neighbors;
-	std::vector<const struct vertex*> vertices;
-	std::vector<const struct edge*> edges;
+	int v0;
+	int v1;
+	int c0 = -1;
+	int c1 = -1;
 };
 
+// the diagram is built straight into flat arrays so the world can adopt them without copying
 class Voronoi {
 public:
-	std::vector<struct cell> cells;
-	std::vector<struct vertex> vertices;
+	std::vector<glm::vec2> centers; // cell sites
+	std::vector<glm::vec2> positions; // vertex positions
 	std::vector<struct edge> edges;
+	struct adjacency cell_neighbors;
+	struct adjacency cell_vertices;
+	struct adjacency cell_edges;
+	struct adjacency vertex_adjacent;
+	struct adjacency vertex_cells;
 public:
-	void gen_diagram(std::vector<glm::vec2> &locations, glm::vec2 min, glm::vec2 max, uint8_t relaxations);
+	// relaxes at most relaxations times, stops early once the sites move less than tolerance on average
+	void gen_diagram(std::vector<glm::vec2> &locations, glm::vec2 min, glm::vec2 max, uint8_t relaxations, float tolerance);
 };
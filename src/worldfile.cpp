@@ -0,0 +1,598 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+
+#include "geom.h"
+#include "imp.h"
+#include "graph.h"
+#include "components.h"
+#include "naming.h"
+#include "voronoi.h"
+#include "terra.h"
+#include "worldmap.h"
+#include "worldfile.h"
+
+static_assert(sizeof(glm::vec2) == 2 * sizeof(float), "points are stored as two floats");
+static_assert(sizeof(struct worldfile_header) % 8 == 0, "the section table has to stay aligned");
+static_assert(sizeof(struct branch) == 24 && sizeof(struct basin) == 8, "branches and basins are stored as they are");
+
+struct sectiondata {
+	const void *data;
+	size_t size;
+};
+
+template <class T>
+static struct sectiondata section_of(const std::vector<T> &array)
+{
+	return { array.data(), array.size() * sizeof(T) };
+}
+
+static inline size_t align_up(size_t n)
+{
+	return (n + WORLDFILE_ALIGNMENT - 1) & ~size_t(WORLDFILE_ALIGNMENT - 1);
+}
+
+uint64_t checksum(const void *data, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t*)data;
+	uint64_t hash = size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+bool save_worldfile(const struct worlddata *world, const std::string &filepath)
+{
+	if (!little_endian_host()) {
+		fprintf(stderr, "World files can only be written on little endian machines\n");
+		return false;
+	}
+
+	const size_t ntiles = world->tiles.size();
+	const size_t ncorners = world->corners.size();
+	const size_t nborders = world->borders.size();
+
+	// split the nodes into one array per attribute
+	std::vector<glm::vec2> centers(ntiles);
+	std::vector<uint8_t> tileflags(ntiles);
+	std::vector<uint8_t> relief(ntiles);
+	std::vector<uint8_t> biomes(ntiles);
+	std::vector<uint8_t> sites(ntiles);
+	std::vector<int32_t> holds(ntiles);
+	std::vector<uint32_t> tilenames(ntiles);
+	for (const auto &t : world->tiles) {
+		centers[t.index] = t.center;
+		tilenames[t.index] = t.name;
+		tileflags[t.index] = pack_flags(t.frontier, t.land, t.coast, t.river, false);
+		relief[t.index] = t.relief;
+		biomes[t.index] = t.biome;
+		sites[t.index] = t.site;
+		holds[t.index] = t.hold;
+	}
+
+	std::vector<glm::vec2> positions(ncorners);
+	std::vector<uint8_t> cornerflags(ncorners);
+	std::vector<int32_t> depths(ncorners);
+	for (const auto &c : world->corners) {
+		positions[c.index] = c.position;
+		cornerflags[c.index] = pack_flags(c.frontier, false, c.coast, c.river, c.wall);
+		depths[c.index] = c.depth;
+	}
+
+	std::vector<struct borderends> ends(nborders);
+	std::vector<uint8_t> borderflags(nborders);
+	for (const auto &b : world->borders) {
+		ends[b.index] = { b.c0, b.c1, b.t0, b.t1 };
+		borderflags[b.index] = pack_flags(b.frontier, false, b.coast, b.river, b.wall);
+	}
+
+	// the lands and neighbors of the holdings as adjacency
+	std::vector<uint32_t> holdcenters(world->holdings.size());
+	std::vector<uint32_t> holdnames(world->holdings.size());
+	struct adjacency holdlands;
+	struct adjacency holdneighbors;
+	for (const auto &hold : world->holdings) {
+		holdcenters[hold.index] = hold.center;
+		holdnames[hold.index] = hold.name;
+		holdlands.links.insert(holdlands.links.end(), hold.lands.begin(), hold.lands.end());
+		end_node(&holdlands);
+		holdneighbors.links.insert(holdneighbors.links.end(), hold.neighbors.begin(), hold.neighbors.end());
+		end_node(&holdneighbors);
+	}
+
+	const struct worldgraph *graph = &world->graph;
+	struct sectiondata data[SECTION_COUNT];
+	data[SECTION_TILE_CENTERS] = section_of(centers);
+	data[SECTION_TILE_FLAGS] = section_of(tileflags);
+	data[SECTION_TILE_RELIEF] = section_of(relief);
+	data[SECTION_TILE_BIOMES] = section_of(biomes);
+	data[SECTION_TILE_SITES] = section_of(sites);
+	data[SECTION_TILE_HOLDS] = section_of(holds);
+	data[SECTION_CORNER_POSITIONS] = section_of(positions);
+	data[SECTION_CORNER_FLAGS] = section_of(cornerflags);
+	data[SECTION_CORNER_DEPTHS] = section_of(depths);
+	data[SECTION_BORDER_ENDS] = section_of(ends);
+	data[SECTION_BORDER_FLAGS] = section_of(borderflags);
+	data[SECTION_NEIGHBOR_OFFSETS] = section_of(graph->neighbors.offsets);
+	data[SECTION_NEIGHBOR_LINKS] = section_of(graph->neighbors.links);
+	data[SECTION_NEIGHBOR_BORDERS] = section_of(graph->neighbor_borders);
+	data[SECTION_TILE_CORNER_OFFSETS] = section_of(graph->corners.offsets);
+	data[SECTION_TILE_CORNER_LINKS] = section_of(graph->corners.links);
+	data[SECTION_TILE_BORDER_OFFSETS] = section_of(graph->borders.offsets);
+	data[SECTION_TILE_BORDER_LINKS] = section_of(graph->borders.links);
+	data[SECTION_ADJACENT_OFFSETS] = section_of(graph->adjacent.offsets);
+	data[SECTION_ADJACENT_LINKS] = section_of(graph->adjacent.links);
+	data[SECTION_ADJACENT_BORDERS] = section_of(graph->adjacent_borders);
+	data[SECTION_TOUCH_OFFSETS] = section_of(graph->touches.offsets);
+	data[SECTION_TOUCH_LINKS] = section_of(graph->touches.links);
+	data[SECTION_TILE_NAMES] = section_of(tilenames);
+	data[SECTION_BRANCHES] = section_of(world->branches);
+	data[SECTION_BASINS] = section_of(world->basins);
+	data[SECTION_HOLD_CENTERS] = section_of(holdcenters);
+	data[SECTION_HOLD_NAMES] = section_of(holdnames);
+	data[SECTION_HOLD_LAND_OFFSETS] = section_of(holdlands.offsets);
+	data[SECTION_HOLD_LAND_LINKS] = section_of(holdlands.links);
+	data[SECTION_HOLD_NEIGHBOR_OFFSETS] = section_of(holdneighbors.offsets);
+	data[SECTION_HOLD_NEIGHBOR_LINKS] = section_of(holdneighbors.links);
+	data[SECTION_NAMES] = section_of(world->names.chars);
+	data[SECTION_BODY_LABELS] = section_of(world->bodies.label);
+	data[SECTION_BODY_SIZES] = section_of(world->bodies.size);
+
+	// lay the sections out behind the header and the section table
+	std::vector<struct worldfile_section> table(SECTION_COUNT);
+	size_t offset = align_up(sizeof(struct worldfile_header) + table.size() * sizeof(struct worldfile_section));
+	for (uint32_t i = 0; i < SECTION_COUNT; i++) {
+		table[i].offset = offset;
+		table[i].size = data[i].size;
+		table[i].checksum = checksum(data[i].data, data[i].size);
+		offset = align_up(offset + data[i].size);
+	}
+
+	struct worldfile_header header;
+	memset(&header, 0, sizeof(struct worldfile_header));
+	header.magic = WORLDFILE_MAGIC;
+	header.version = WORLDFILE_VERSION;
+	header.seed = world->seed;
+	header.tilecount = ntiles;
+	header.cornercount = ncorners;
+	header.bordercount = nborders;
+	header.branchcount = world->branches.size();
+	header.basincount = world->basins.size();
+	header.holdcount = world->holdings.size();
+	header.bodycount = world->bodies.size.size();
+	header.namesize = world->names.chars.size();
+	header.sectioncount = SECTION_COUNT;
+	header.tablechecksum = checksum(table.data(), table.size() * sizeof(struct worldfile_section));
+
+	// written next to the target and renamed over it so readers that have the old file mapped never see a partial file
+	std::string temppath = filepath + ".tmp";
+	FILE *fp = fopen(temppath.c_str(), "wb");
+	if (!fp) {
+		perror("File opening failed");
+		return false;
+	}
+
+	static const char padding[WORLDFILE_ALIGNMENT] = {0};
+	size_t position = 0;
+	position += fwrite(&header, 1, sizeof(struct worldfile_header), fp);
+	position += fwrite(table.data(), 1, table.size() * sizeof(struct worldfile_section), fp);
+	for (uint32_t i = 0; i < SECTION_COUNT; i++) {
+		position += fwrite(padding, 1, table[i].offset - position, fp);
+		position += fwrite(data[i].data, 1, data[i].size, fp);
+	}
+	position += fwrite(padding, 1, offset - position, fp);
+
+	bool failed = ferror(fp) || position != offset;
+	failed = fclose(fp) != 0 || failed;
+	if (failed || rename(temppath.c_str(), filepath.c_str()) != 0) {
+		perror("Writing world file failed");
+		remove(temppath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static inline const void *section_data(const struct worldview *view, enum WORLDFILE_SECTION section)
+{
+	return view->data + view->sections[section].offset;
+}
+
+// the section has to lie inside the file and have the expected size
+static bool section_fits(const struct worldview *view, enum WORLDFILE_SECTION section, size_t size)
+{
+	const struct worldfile_section *s = &view->sections[section];
+
+	return s->offset % WORLDFILE_ALIGNMENT == 0 && s->size == size && s->offset <= view->size && s->size <= view->size - s->offset;
+}
+
+static bool bind_adjacency(const struct worldview *view, enum WORLDFILE_SECTION offsets, enum WORLDFILE_SECTION links, size_t count, struct csrview *graph)
+{
+	if (!section_fits(view, offsets, (count + 1) * sizeof(uint32_t))) {
+		return false;
+	}
+	graph->offsets = (const uint32_t*)section_data(view, offsets);
+	graph->count = count;
+	if (graph->offsets[0] != 0) {
+		return false;
+	}
+	// rows can't run backwards, so every row lies inside the links once the last offset does
+	for (size_t i = 0; i < count; i++) {
+		if (graph->offsets[i+1] < graph->offsets[i]) {
+			return false;
+		}
+	}
+	if (!section_fits(view, links, graph->offsets[count] * sizeof(uint32_t))) {
+		return false;
+	}
+	graph->links = (const uint32_t*)section_data(view, links);
+
+	return true;
+}
+
+// points the view into the mapped data, only the header and the offsets of each adjacency are read
+static bool bind_view(struct worldview *view)
+{
+	if (view->size < sizeof(struct worldfile_header)) {
+		return false;
+	}
+	const struct worldfile_header *header = (const struct worldfile_header*)view->data;
+	if (header->magic != WORLDFILE_MAGIC || header->version != WORLDFILE_VERSION || header->sectioncount < SECTION_COUNT) {
+		return false;
+	}
+	if (header->sectioncount > (view->size - sizeof(struct worldfile_header)) / sizeof(struct worldfile_section)) {
+		return false;
+	}
+	view->header = header;
+	view->sections = (const struct worldfile_section*)(view->data + sizeof(struct worldfile_header));
+
+	const size_t ntiles = header->tilecount;
+	const size_t ncorners = header->cornercount;
+	const size_t nborders = header->bordercount;
+	bool fits = section_fits(view, SECTION_TILE_CENTERS, ntiles * sizeof(glm::vec2))
+		&& section_fits(view, SECTION_TILE_FLAGS, ntiles)
+		&& section_fits(view, SECTION_TILE_RELIEF, ntiles)
+		&& section_fits(view, SECTION_TILE_BIOMES, ntiles)
+		&& section_fits(view, SECTION_TILE_SITES, ntiles)
+		&& section_fits(view, SECTION_TILE_HOLDS, ntiles * sizeof(int32_t))
+		&& section_fits(view, SECTION_CORNER_POSITIONS, ncorners * sizeof(glm::vec2))
+		&& section_fits(view, SECTION_CORNER_FLAGS, ncorners)
+		&& section_fits(view, SECTION_CORNER_DEPTHS, ncorners * sizeof(int32_t))
+		&& section_fits(view, SECTION_BORDER_ENDS, nborders * sizeof(struct borderends))
+		&& section_fits(view, SECTION_BORDER_FLAGS, nborders)
+		&& bind_adjacency(view, SECTION_NEIGHBOR_OFFSETS, SECTION_NEIGHBOR_LINKS, ntiles, &view->neighbors)
+		&& bind_adjacency(view, SECTION_TILE_CORNER_OFFSETS, SECTION_TILE_CORNER_LINKS, ntiles, &view->corners)
+		&& bind_adjacency(view, SECTION_TILE_BORDER_OFFSETS, SECTION_TILE_BORDER_LINKS, ntiles, &view->borders)
+		&& bind_adjacency(view, SECTION_ADJACENT_OFFSETS, SECTION_ADJACENT_LINKS, ncorners, &view->adjacent)
+		&& bind_adjacency(view, SECTION_TOUCH_OFFSETS, SECTION_TOUCH_LINKS, ncorners, &view->touches)
+		&& section_fits(view, SECTION_TILE_NAMES, ntiles * sizeof(uint32_t))
+		&& section_fits(view, SECTION_BRANCHES, header->branchcount * sizeof(struct branch))
+		&& section_fits(view, SECTION_BASINS, header->basincount * sizeof(struct basin))
+		&& section_fits(view, SECTION_HOLD_CENTERS, header->holdcount * sizeof(uint32_t))
+		&& section_fits(view, SECTION_HOLD_NAMES, header->holdcount * sizeof(uint32_t))
+		&& bind_adjacency(view, SECTION_HOLD_LAND_OFFSETS, SECTION_HOLD_LAND_LINKS, header->holdcount, &view->holdlands)
+		&& bind_adjacency(view, SECTION_HOLD_NEIGHBOR_OFFSETS, SECTION_HOLD_NEIGHBOR_LINKS, header->holdcount, &view->holdneighbors)
+		&& section_fits(view, SECTION_NAMES, header->namesize)
+		&& section_fits(view, SECTION_BODY_LABELS, (header->bodycount ? ntiles : 0) * sizeof(uint32_t))
+		&& section_fits(view, SECTION_BODY_SIZES, header->bodycount * sizeof(uint32_t));
+	if (!fits) {
+		return false;
+	}
+	if (!section_fits(view, SECTION_NEIGHBOR_BORDERS, view->neighbors.offsets[ntiles] * sizeof(uint32_t))) {
+		return false;
+	}
+	if (!section_fits(view, SECTION_ADJACENT_BORDERS, view->adjacent.offsets[ncorners] * sizeof(uint32_t))) {
+		return false;
+	}
+	// names are read up to their terminator so the pool has to end with one
+	if (header->namesize == 0 || view->data[view->sections[SECTION_NAMES].offset + header->namesize - 1] != '\0') {
+		return false;
+	}
+
+	view->centers = (const glm::vec2*)section_data(view, SECTION_TILE_CENTERS);
+	view->tileflags = (const uint8_t*)section_data(view, SECTION_TILE_FLAGS);
+	view->relief = (const enum RELIEF*)section_data(view, SECTION_TILE_RELIEF);
+	view->biomes = (const enum BIOME*)section_data(view, SECTION_TILE_BIOMES);
+	view->sites = (const enum SITE*)section_data(view, SECTION_TILE_SITES);
+	view->holds = (const int32_t*)section_data(view, SECTION_TILE_HOLDS);
+	view->positions = (const glm::vec2*)section_data(view, SECTION_CORNER_POSITIONS);
+	view->cornerflags = (const uint8_t*)section_data(view, SECTION_CORNER_FLAGS);
+	view->depths = (const int32_t*)section_data(view, SECTION_CORNER_DEPTHS);
+	view->ends = (const struct borderends*)section_data(view, SECTION_BORDER_ENDS);
+	view->borderflags = (const uint8_t*)section_data(view, SECTION_BORDER_FLAGS);
+	view->neighbor_borders = (const uint32_t*)section_data(view, SECTION_NEIGHBOR_BORDERS);
+	view->adjacent_borders = (const uint32_t*)section_data(view, SECTION_ADJACENT_BORDERS);
+	view->tilenames = (const uint32_t*)section_data(view, SECTION_TILE_NAMES);
+	view->branches = (const struct branch*)section_data(view, SECTION_BRANCHES);
+	view->basins = (const struct basin*)section_data(view, SECTION_BASINS);
+	view->holdcenters = (const uint32_t*)section_data(view, SECTION_HOLD_CENTERS);
+	view->holdnames = (const uint32_t*)section_data(view, SECTION_HOLD_NAMES);
+	view->names = (const char*)section_data(view, SECTION_NAMES);
+	view->bodylabels = (const uint32_t*)section_data(view, SECTION_BODY_LABELS);
+	view->bodysizes = (const uint32_t*)section_data(view, SECTION_BODY_SIZES);
+
+	return true;
+}
+
+bool open_worldfile(const std::string &filepath, struct worldview *view, bool verify)
+{
+	*view = worldview();
+	if (!little_endian_host()) {
+		fprintf(stderr, "World files can only be read on little endian machines\n");
+		return false;
+	}
+
+	int fd = open(filepath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		perror("File opening failed");
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		fprintf(stderr, "Malformed world file %s\n", filepath.c_str());
+		close(fd);
+		return false;
+	}
+	// the mapping stays valid after the descriptor is closed
+	void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		perror("Mapping world file failed");
+		return false;
+	}
+	view->data = (const uint8_t*)mapping;
+	view->size = info.st_size;
+
+	if (!bind_view(view) || (verify && !verify_worldfile(view))) {
+		fprintf(stderr, "Malformed world file %s\n", filepath.c_str());
+		close_worldfile(view);
+		return false;
+	}
+
+	return true;
+}
+
+void close_worldfile(struct worldview *view)
+{
+	if (view->data) {
+		munmap((void*)view->data, view->size);
+	}
+	*view = worldview();
+}
+
+bool verify_worldfile(const struct worldview *view)
+{
+	const struct worldfile_header *header = view->header;
+	if (checksum(view->sections, header->sectioncount * sizeof(struct worldfile_section)) != header->tablechecksum) {
+		return false;
+	}
+	for (uint32_t i = 0; i < header->sectioncount; i++) {
+		const struct worldfile_section *s = &view->sections[i];
+		if (s->offset > view->size || s->size > view->size - s->offset) {
+			return false;
+		}
+		if (checksum(view->data + s->offset, s->size) != s->checksum) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool links_within(const std::vector<uint32_t> &links, size_t range)
+{
+	for (uint32_t link : links) {
+		if (link >= range) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// rows have to follow each other without running backwards and end with the links
+static bool adjacency_within(const struct adjacency *graph, size_t count, size_t range)
+{
+	if (graph->offsets.size() != count + 1 || graph->offsets[0] != 0 || graph->offsets[count] != graph->links.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (graph->offsets[i+1] < graph->offsets[i]) {
+			return false;
+		}
+	}
+
+	return links_within(graph->links, range);
+}
+
+// borders that were never matched to a link are marked with NO_BORDER
+static bool link_borders_within(const std::vector<uint32_t> &borders, const struct adjacency *graph, size_t nborders)
+{
+	if (borders.size() != graph->links.size()) {
+		return false;
+	}
+	for (uint32_t border : borders) {
+		if (border != NO_BORDER && border >= nborders) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static inline bool branch_within(uint32_t branch, size_t count)
+{
+	return branch == NO_BRANCH || branch < count;
+}
+
+bool check_indices(const struct worlddata *world)
+{
+	const size_t ntiles = world->tiles.size();
+	const size_t ncorners = world->corners.size();
+	const size_t nborders = world->borders.size();
+	const size_t nholds = world->holdings.size();
+	const size_t nbranches = world->branches.size();
+	const size_t namesize = world->names.chars.size();
+	const struct worldgraph *graph = &world->graph;
+
+	// names are read up to their terminator
+	if (namesize == 0 || world->names.chars.back() != '\0') {
+		return false;
+	}
+
+	bool within = adjacency_within(&graph->neighbors, ntiles, ntiles)
+		&& adjacency_within(&graph->corners, ntiles, ncorners)
+		&& adjacency_within(&graph->borders, ntiles, nborders)
+		&& adjacency_within(&graph->adjacent, ncorners, ncorners)
+		&& adjacency_within(&graph->touches, ncorners, ntiles)
+		&& link_borders_within(graph->neighbor_borders, &graph->neighbors, nborders)
+		&& link_borders_within(graph->adjacent_borders, &graph->adjacent, nborders);
+	if (!within) {
+		return false;
+	}
+
+	for (const auto &t : world->tiles) {
+		if (t.name >= namesize || t.hold < -1 || t.hold >= int64_t(nholds)) { return false; }
+	}
+	for (const auto &b : world->borders) {
+		if (b.c0 >= ncorners || b.c1 >= ncorners || b.t0 >= ntiles || b.t1 >= ntiles) { return false; }
+	}
+	for (const auto &node : world->branches) {
+		if (node.confluence >= ncorners) { return false; }
+		if (!branch_within(node.parent, nbranches) || !branch_within(node.left, nbranches) || !branch_within(node.right, nbranches)) {
+			return false;
+		}
+	}
+	for (const auto &basin : world->basins) {
+		if (basin.first >= nbranches || basin.mouth >= nbranches) { return false; }
+	}
+	for (const auto &hold : world->holdings) {
+		if (hold.center >= ntiles || hold.name >= namesize) { return false; }
+		if (!links_within(hold.lands, ntiles) || !links_within(hold.neighbors, nholds)) { return false; }
+	}
+
+	// landmasses are either missing or labelled for every tile
+	const struct components *bodies = &world->bodies;
+	if (bodies->label.size() != (bodies->size.empty() ? 0 : ntiles) || !links_within(bodies->label, bodies->size.size())) {
+		return false;
+	}
+
+	return true;
+}
+
+static void materialize_adjacency(const struct csrview *view, struct adjacency *graph)
+{
+	graph->offsets.assign(view->offsets, view->offsets + view->count + 1);
+	graph->links.assign(view->links, view->links + view->offsets[view->count]);
+}
+
+bool materialize_world(const struct worldview *view, struct worlddata *world)
+{
+	const size_t ntiles = view->header->tilecount;
+	const size_t ncorners = view->header->cornercount;
+	const size_t nborders = view->header->bordercount;
+	// built on the side so the world is left untouched if the view doesn't check out
+	struct worlddata built;
+
+	built.seed = view->header->seed;
+
+	built.tiles.resize(ntiles);
+	for (size_t i = 0; i < ntiles; i++) {
+		struct tile &t = built.tiles[i];
+		uint8_t flags = view->tileflags[i];
+		t.index = i;
+		t.center = view->centers[i];
+		t.frontier = flags & FLAG_FRONTIER;
+		t.land = flags & FLAG_LAND;
+		t.coast = flags & FLAG_COAST;
+		t.river = flags & FLAG_RIVER;
+		t.relief = view->relief[i];
+		t.biome = view->biomes[i];
+		t.site = view->sites[i];
+		t.name = view->tilenames[i];
+		t.hold = view->holds[i];
+	}
+
+	built.corners.resize(ncorners);
+	for (size_t i = 0; i < ncorners; i++) {
+		struct corner &c = built.corners[i];
+		uint8_t flags = view->cornerflags[i];
+		c.index = i;
+		c.position = view->positions[i];
+		c.frontier = flags & FLAG_FRONTIER;
+		c.coast = flags & FLAG_COAST;
+		c.river = flags & FLAG_RIVER;
+		c.wall = flags & FLAG_WALL;
+		c.depth = view->depths[i];
+	}
+
+	built.borders.resize(nborders);
+	for (size_t i = 0; i < nborders; i++) {
+		struct border &b = built.borders[i];
+		uint8_t flags = view->borderflags[i];
+		b.index = i;
+		b.c0 = view->ends[i].c0;
+		b.c1 = view->ends[i].c1;
+		b.t0 = view->ends[i].t0;
+		b.t1 = view->ends[i].t1;
+		b.frontier = flags & FLAG_FRONTIER;
+		b.coast = flags & FLAG_COAST;
+		b.river = flags & FLAG_RIVER;
+		b.wall = flags & FLAG_WALL;
+	}
+
+	struct worldgraph *graph = &built.graph;
+	materialize_adjacency(&view->neighbors, &graph->neighbors);
+	materialize_adjacency(&view->corners, &graph->corners);
+	materialize_adjacency(&view->borders, &graph->borders);
+	materialize_adjacency(&view->adjacent, &graph->adjacent);
+	materialize_adjacency(&view->touches, &graph->touches);
+	graph->neighbor_borders.assign(view->neighbor_borders, view->neighbor_borders + graph->neighbors.links.size());
+	graph->adjacent_borders.assign(view->adjacent_borders, view->adjacent_borders + graph->adjacent.links.size());
+
+	built.branches.assign(view->branches, view->branches + view->header->branchcount);
+	built.basins.assign(view->basins, view->basins + view->header->basincount);
+
+	built.holdings.resize(view->header->holdcount);
+	for (size_t i = 0; i < built.holdings.size(); i++) {
+		struct holding &hold = built.holdings[i];
+		const struct span lands = view->holdlands[i];
+		const struct span neighbors = view->holdneighbors[i];
+		hold.index = i;
+		hold.center = view->holdcenters[i];
+		hold.name = view->holdnames[i];
+		hold.lands.assign(lands.begin(), lands.end());
+		hold.neighbors.assign(neighbors.begin(), neighbors.end());
+	}
+
+	adopt_names(&built.names, view->names, view->header->namesize);
+
+	const size_t nlabels = view->sections[SECTION_BODY_LABELS].size / sizeof(uint32_t);
+	built.bodies.label.assign(view->bodylabels, view->bodylabels + nlabels);
+	built.bodies.size.assign(view->bodysizes, view->bodysizes + view->header->bodycount);
+
+	if (!check_indices(&built)) {
+		return false;
+	}
+	*world = std::move(built);
+
+	return true;
+}
@@ -0,0 +1,176 @@
+/*
+ * worldfile - flat binary world format that can be mapped and read in place
+ */
+
+#define WORLDFILE_MAGIC 0x444c5257 // "WRLD" in little endian
+#define WORLDFILE_VERSION 2
+#define WORLDFILE_ALIGNMENT 64 // sections start on cache lines
+
+// sections are stored in this order, new sections are only ever appended
+enum WORLDFILE_SECTION : uint32_t {
+	SECTION_TILE_CENTERS,
+	SECTION_TILE_FLAGS,
+	SECTION_TILE_RELIEF,
+	SECTION_TILE_BIOMES,
+	SECTION_TILE_SITES,
+	SECTION_TILE_HOLDS,
+	SECTION_CORNER_POSITIONS,
+	SECTION_CORNER_FLAGS,
+	SECTION_CORNER_DEPTHS,
+	SECTION_BORDER_ENDS,
+	SECTION_BORDER_FLAGS,
+	SECTION_NEIGHBOR_OFFSETS,
+	SECTION_NEIGHBOR_LINKS,
+	SECTION_NEIGHBOR_BORDERS,
+	SECTION_TILE_CORNER_OFFSETS,
+	SECTION_TILE_CORNER_LINKS,
+	SECTION_TILE_BORDER_OFFSETS,
+	SECTION_TILE_BORDER_LINKS,
+	SECTION_ADJACENT_OFFSETS,
+	SECTION_ADJACENT_LINKS,
+	SECTION_ADJACENT_BORDERS,
+	SECTION_TOUCH_OFFSETS,
+	SECTION_TOUCH_LINKS,
+	SECTION_TILE_NAMES,
+	SECTION_BRANCHES,
+	SECTION_BASINS,
+	SECTION_HOLD_CENTERS,
+	SECTION_HOLD_NAMES,
+	SECTION_HOLD_LAND_OFFSETS,
+	SECTION_HOLD_LAND_LINKS,
+	SECTION_HOLD_NEIGHBOR_OFFSETS,
+	SECTION_HOLD_NEIGHBOR_LINKS,
+	SECTION_NAMES,
+	SECTION_BODY_LABELS,
+	SECTION_BODY_SIZES,
+	SECTION_COUNT
+};
+
+// bits of the flag arrays
+enum NODE_FLAG : uint8_t {
+	FLAG_FRONTIER = 1,
+	FLAG_LAND = 2,
+	FLAG_COAST = 4,
+	FLAG_RIVER = 8,
+	FLAG_WALL = 16
+};
+
+inline uint8_t pack_flags(bool frontier, bool land, bool coast, bool river, bool wall)
+{
+	return (frontier ? FLAG_FRONTIER : 0) | (land ? FLAG_LAND : 0) | (coast ? FLAG_COAST : 0) | (river ? FLAG_RIVER : 0) | (wall ? FLAG_WALL : 0);
+}
+
+// all fields are little endian
+struct worldfile_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t seed;
+	uint32_t tilecount;
+	uint32_t cornercount;
+	uint32_t bordercount;
+	uint32_t branchcount;
+	uint32_t basincount;
+	uint32_t holdcount;
+	uint32_t bodycount; // landmasses and seas
+	uint32_t namesize; // bytes in the name pool
+	uint32_t reserved;
+	uint32_t sectioncount; // entries in the section table that follows the header
+	uint64_t tablechecksum; // checksum of the section table
+};
+
+struct worldfile_section {
+	uint64_t offset; // from the start of the file
+	uint64_t size; // in bytes
+	uint64_t checksum;
+};
+
+struct borderends {
+	uint32_t c0;
+	uint32_t c1;
+	uint32_t t0;
+	uint32_t t1;
+};
+
+// compressed sparse row adjacency over arrays it doesn't own
+struct csrview {
+	const uint32_t *offsets = nullptr;
+	const uint32_t *links = nullptr;
+	size_t count = 0;
+	size_t size(void) const { return count; }
+	struct span operator[](size_t node) const
+	{
+		struct span s;
+		s.first = links + offsets[node];
+		s.last = links + offsets[node+1];
+		return s;
+	}
+};
+
+// read only world that points straight into a mapped file
+struct worldview {
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+	const struct worldfile_header *header = nullptr;
+	const struct worldfile_section *sections = nullptr;
+	// node attributes indexed by node
+	const glm::vec2 *centers = nullptr;
+	const uint8_t *tileflags = nullptr;
+	const enum RELIEF *relief = nullptr;
+	const enum BIOME *biomes = nullptr;
+	const enum SITE *sites = nullptr;
+	const int32_t *holds = nullptr;
+	const glm::vec2 *positions = nullptr;
+	const uint8_t *cornerflags = nullptr;
+	const int32_t *depths = nullptr;
+	const struct borderends *ends = nullptr;
+	const uint8_t *borderflags = nullptr;
+	// the graph, same layout as worldgraph
+	struct csrview neighbors;
+	struct csrview corners;
+	struct csrview borders;
+	struct csrview adjacent;
+	struct csrview touches;
+	const uint32_t *neighbor_borders = nullptr; // parallel to neighbors.links
+	const uint32_t *adjacent_borders = nullptr; // parallel to adjacent.links
+	// rivers, holdings and names
+	const uint32_t *tilenames = nullptr; // handles into names
+	const struct branch *branches = nullptr;
+	const struct basin *basins = nullptr;
+	const uint32_t *holdcenters = nullptr;
+	const uint32_t *holdnames = nullptr;
+	struct csrview holdlands;
+	struct csrview holdneighbors;
+	const char *names = nullptr; // the name pool of the world
+	const uint32_t *bodylabels = nullptr; // landmass or sea of each tile
+	const uint32_t *bodysizes = nullptr;
+};
+
+inline bool little_endian_host(void)
+{
+	const uint16_t probe = 1;
+
+	return *(const uint8_t*)&probe == 1;
+}
+
+// word at a time multiplicative hash, cheap enough to run over the whole file on load
+uint64_t checksum(const void *data, size_t size);
+
+// true if every index in the world points inside the array it refers to, loaded worlds are checked before they're handed out
+// checksums only catch damage, not a file that was written wrong
+bool check_indices(const struct worlddata *world);
+
+// writes the world in the flat format, returns false if it couldn't be written
+bool save_worldfile(const struct worlddata *world, const std::string &filepath);
+
+// maps the file read only and points the view into it, returns false if the file is missing or malformed
+// the section sizes are always checked but the checksums only if verify is set since that reads the whole file
+bool open_worldfile(const std::string &filepath, struct worldview *view, bool verify);
+
+void close_worldfile(struct worldview *view);
+
+// compares every section with its checksum
+bool verify_worldfile(const struct worldview *view);
+
+// copies the view into the world so it can be changed
+// returns false and leaves the world untouched if any index in the view points outside its array
+bool materialize_world(const struct worldview *view, struct worlddata *world);
@@ -1,50 +1,64 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
-#include <random>
-#include <map>
 #include <unordered_map>
-#include <list>
-#include <queue>
 #include <chrono>
+#include <functional>
+#include <array>
+#include <climits>
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 
 #include "extern/INIReader.h"
-#include "extern/poisson_disk_sampling.h"
-#include "extern/namegen.h"
 
 #include "geom.h"
 #include "imp.h"
+#include "parallel.h"
+#include "poisson.h"
+#include "random.h"
+#include "graph.h"
+#include "components.h"
+#include "naming.h"
 #include "voronoi.h"
 #include "terra.h"
 #include "worldmap.h"
 
 enum TEMPERATURE { COLD, TEMPERATE, WARM };
 enum VEGETATION { ARID, DRY, HUMID };
+// random streams of the stochastic stages
+enum RANDOM_STAGE { RANDOM_BIOMES, RANDOM_VILLAGES, RANDOM_SITES, RANDOM_HOLD_NAMES, RANDOM_SITE_NAMES };
 
 static struct worldparams import_noiseparams(const char *fpath);
-static struct branch *insert(const struct corner *confluence);
-static void delete_basin(struct basin *tree);
-static void prune_branches(struct branch *root);
-static void stream_postorder(struct basin *tree);
-static enum TEMPERATURE pick_temperature(float warmth);
-static enum BIOME pick_biome(enum RELIEF relief, enum TEMPERATURE temper, enum VEGETATION veg);
-static void spawn_towns(std::vector<struct tile*> &candidates, std::unordered_map<const struct tile*, bool> &visited, std::unordered_map<const struct tile*, int> &depth);
-static void spawn_castles(std::vector<struct tile*> &candidates, std::unordered_map<const struct tile*, bool> &visited, std::unordered_map<const struct tile*, int> &depth);
-static void spawn_villages(std::vector<struct tile*> &candidates, std::unordered_map<const struct tile*, bool> &visited, std::unordered_map<const struct tile*, int> &depth, long seed);
-static void import_pattern(const char *fpath, std::string &pattern);
+static void for_each_basin(const std::vector<struct basin> &basins, const std::function<void(const struct basin*)> &job);
+static void stream_postorder(std::vector<struct branch> &branches, const struct basin *bas);
+static void prune_branch(std::vector<struct branch> &branches, std::vector<uint8_t> &pruned, uint32_t node);
+static void prune_tributaries(std::vector<struct branch> &branches, const struct basin *bas, std::vector<uint8_t> &pruned, const std::function<bool(const struct branch*)> &prunable);
+static void compact_basins(std::vector<struct branch> &branches, std::vector<struct basin> &basins, std::vector<uint8_t> &pruned);
+static void erode_highlands(std::vector<struct tile> &tiles, const struct worldgraph *graph, const std::vector<uint8_t> &eroding);
+static void spawn_towns(std::vector<struct tile> &tiles, const std::vector<struct corner> &corners, const struct worldgraph *graph, const std::vector<uint32_t> &candidates, struct traversal *walk);
+static void spawn_castles(std::vector<struct tile> &tiles, const struct worldgraph *graph, const std::vector<uint32_t> &candidates, struct traversal *walk);
+static void spawn_villages(std::vector<struct tile> &tiles, const struct worldgraph *graph, const std::vector<uint32_t> &candidates, long seed);
+static void place_towns(std::vector<struct tile> &tiles, const std::vector<struct corner> &corners, const struct worldgraph *graph, const std::vector<uint32_t> &candidates);
+static void place_castles(std::vector<struct tile> &tiles, const std::vector<uint32_t> &candidates);
 
 static const size_t DIM = 256;
-static const uint8_t N_RELAXATIONS = 1;
+static const uint8_t N_RELAXATIONS = 4;
+// stop relaxing once the sites move less than this on average
+static const float RELAXATION_TOLERANCE = 0.5F;
 static const float BOUND_OFFSET = 10.F;
 static const float POISSON_DISK_RADIUS = 16.F;
+static const uint32_t POISSON_DISK_ATTEMPTS = 30;
 static const int MIN_STREAM_ORDER = 4;
+static const size_t TILE_BATCH = 4096;
 static const size_t TERRA_IMAGE_RES = 512;
 static const size_t MIN_WATER_BODY = 1024;
 static const size_t MIN_MOUNTAIN_BODY = 128;
 static const int TOWN_SPAWN_RADIUS = 8;
 static const int CASTLE_SPAWN_RADIUS = 10;
+// rough distance between the centers of neighboring tiles, turns the hop radii into distances
+static const float HOP_LENGTH = 1.25F * POISSON_DISK_RADIUS;
+static const float TOWN_SPAWN_DISTANCE = TOWN_SPAWN_RADIUS * HOP_LENGTH;
+static const float CASTLE_SPAWN_DISTANCE = CASTLE_SPAWN_RADIUS * HOP_LENGTH;
 static const char *WORLDGEN_INI_FPATH = "worldgen.ini";
 static const float MIN_RIVER_DIST = 40.F;
 static const bool ERODABLE_MOUNTAINS = true;
@@ -66,20 +80,126 @@ static const struct worldparams DEFAULT_WORLD_PARAMETERS = {
 	.lowland = 0.48f,
 	.upland = 0.58f,
 	.highland = 0.66f,
+	.erodmountains = false,
+	// sites
+	.hopspacing = false,
+	// performance
+	.threads = 0,
+	.sampledterra = false,
 };
 
+static constexpr enum TEMPERATURE pick_temperature(float warmth)
+{
+	enum TEMPERATURE temperature = COLD;
+
+	if (warmth > 0.75f) {
+		temperature = WARM;
+	} else if (warmth < 0.25f) {
+		temperature = COLD;
+	} else {
+		temperature = TEMPERATE;
+	}
+
+	return temperature;
+}
+
+static constexpr enum BIOME pick_biome(enum RELIEF relief, enum TEMPERATURE temper, enum VEGETATION veg)
+{
+	if (relief == SEABED) { return SEA; } // pretty obvious
+
+	// mountain biomes
+	if (relief == HIGHLAND) {
+		if (temper == WARM && veg == ARID) {
+			return BADLANDS;
+		} else {
+			return GLACIER;
+		}
+	}
+
+	if (temper == COLD) {
+		switch (veg) {
+		case ARID: return STEPPE;
+		case DRY: return PINE_GRASSLAND;
+		case HUMID: return PINE_FOREST;
+		};
+	} else if (temper == TEMPERATE) {
+		switch (veg) {
+		case ARID: return STEPPE;
+		case DRY: return BROADLEAF_GRASSLAND;
+		case HUMID: return BROADLEAF_FOREST;
+		};
+	} else if (temper == WARM) {
+		switch (veg) {
+		case ARID: return DESERT;
+		case DRY: return SAVANNA;
+		case HUMID: return SHRUBLAND;
+		};
+	}
+
+	return GLACIER; // the impossible happened
+}
+
+// tiles next to mountains grow pine, dry deserts along rivers flood
+static constexpr enum BIOME classify_biome(enum RELIEF relief, enum TEMPERATURE temper, enum VEGETATION veg, bool alpine, bool river)
+{
+	enum BIOME biome = pick_biome(relief, temper, veg);
+	if (biome == DESERT && relief == LOWLAND && river == true) {
+		biome = FLOODPLAIN;
+	}
+	if (relief == UPLAND && alpine == true) {
+		if (veg == DRY) {
+			biome = PINE_GRASSLAND;
+		} else if (veg == HUMID) {
+			biome = PINE_FOREST;
+		}
+	}
+
+	return biome;
+}
+
+// every combination of tile properties classified ahead of time
+struct biometable {
+	enum BIOME biomes[2][2][4][3][3]; // river, alpine, relief, temperature, vegetation
+};
+
+static constexpr struct biometable make_biome_table(void)
+{
+	struct biometable table = {};
+	for (int river = 0; river < 2; river++) {
+		for (int alpine = 0; alpine < 2; alpine++) {
+			for (int relief = SEABED; relief <= HIGHLAND; relief++) {
+				for (int temper = COLD; temper <= WARM; temper++) {
+					for (int veg = ARID; veg <= HUMID; veg++) {
+						table.biomes[river][alpine][relief][temper][veg] = classify_biome((enum RELIEF)relief, (enum TEMPERATURE)temper, (enum VEGETATION)veg, alpine, river);
+					}
+				}
+			}
+		}
+	}
+
+	return table;
+}
+
+static constexpr struct biometable BIOME_TABLE = make_biome_table();
+
 Worldmap::Worldmap(struct rectangle area)
 {
 	this->area = area;
+
+	load_pattern("names/region.txt", &regionnames);
+	load_pattern("names/town.txt", &townnames);
+	load_pattern("names/fort.txt", &fortnames);
+	load_pattern("names/village.txt", &villagenames);
 }
 
 void Worldmap::generate(long seed) 
 {
 	this->seed = seed;
 	this->params = import_noiseparams(WORLDGEN_INI_FPATH);
+	set_worker_count(params.threads);
 
 auto start = std::chrono::steady_clock::now();
-	terra = form_terra(TERRA_IMAGE_RES, this->seed, this->params);
+	terra = form_terra(TERRA_IMAGE_RES, this->seed, this->params, params.sampledterra ? TERRA_SAMPLED : TERRA_RASTER);
 auto end = std::chrono::steady_clock::now();
 std::chrono::duration<double> elapsed_seconds = end-start;
 std::cout << "terra elapsed time: " << elapsed_seconds.count() << "s\n";
@@ -91,7 +211,7 @@ elapsed_seconds = end-start;
 std::cout << "diagram elapsed time: " << elapsed_seconds.count() << "s\n";
 
 start = std::chrono::steady_clock::now();
-	gen_relief(&terra.heightmap);
+	gen_relief();
 end = std::chrono::steady_clock::now();
 elapsed_seconds = end-start;
 std::cout << "relief elapsed time: " << elapsed_seconds.count() << "s\n";
@@ -123,7 +243,7 @@ start = std::chrono::steady_clock::now();
 	// villages always have to be part of a hold
 	// we can't let the peasants be independent
 	for (auto &t : tiles) {
-		if (t.site == VILLAGE && t.hold == nullptr) {
+		if (t.site == VILLAGE && t.hold < 0) {
 			t.site = VACANT;
 		}
 	}
@@ -132,8 +252,9 @@ elapsed_seconds = end-start;
 std::cout << "gen holds elapsed time: " << elapsed_seconds.count() << "s\n";
 
 start = std::chrono::steady_clock::now();
-	//name_holds();
-	//name_sites();
+	reset_names(&names);
+	name_holds();
+	name_sites();
 end = std::chrono::steady_clock::now();
 elapsed_seconds = end-start;
 std::cout << "names elapsed time: " << elapsed_seconds.count() << "s\n";
@@ -141,170 +262,191 @@ std::cout << "names elapsed time: " << elapsed_seconds.count() << "s\n";
 
 Worldmap::~Worldmap(void)
 {
-	delete_byteimage(&terra.heightmap);
-	delete_byteimage(&terra.tempmap);
-	delete_byteimage(&terra.rainmap);
-
-	for (auto &bas : basins) {
-		delete_basin(&bas);
-	}
+	delete_shortimage(&terra.heightmap);
+	delete_shortimage(&terra.tempmap);
+	delete_shortimage(&terra.rainmap);
+	delete_shortimage(&terra.moisture);
 }
 
 void Worldmap::gen_diagram(unsigned int maxcandidates)
 {
 	float radius = POISSON_DISK_RADIUS;
 
-	auto min = std::array<float, 2>{{area.min.x + BOUND_OFFSET, area.min.y + BOUND_OFFSET}};
-	auto max = std::array<float, 2>{{area.max.x - BOUND_OFFSET, area.max.y - BOUND_OFFSET}};
+	glm::vec2 min = {area.min.x + BOUND_OFFSET, area.min.y + BOUND_OFFSET};
+	glm::vec2 max = {area.max.x - BOUND_OFFSET, area.max.y - BOUND_OFFSET};
 
-	std::vector<std::array<float, 2>> candidates = thinks::PoissonDiskSampling(radius, min, max, 30, seed);
-	std::vector<glm::vec2> locations;
-	for (const auto &point : candidates) {
-		locations.push_back(glm::vec2(point[0], point[1]));
-	}
+	std::vector<glm::vec2> locations = poisson_disk_sample(radius, min, max, POISSON_DISK_ATTEMPTS, seed);
 
-	// copy voronoi graph
+	// adopt the voronoi graph, the adjacency arrays are moved instead of copied
 	Voronoi voronoi;
-	voronoi.gen_diagram(locations, area.min, area.max, N_RELAXATIONS);
+	voronoi.gen_diagram(locations, area.min, area.max, N_RELAXATIONS, RELAXATION_TOLERANCE);
+
+	graph.neighbors = std::move(voronoi.cell_neighbors);
+	graph.corners = std::move(voronoi.cell_vertices);
+	graph.borders = std::move(voronoi.cell_edges);
+	graph.adjacent = std::move(voronoi.vertex_adjacent);
+	graph.touches = std::move(voronoi.vertex_cells);
+
+	tiles.resize(voronoi.centers.size());
+	for (int i = 0; i < tiles.size(); i++) {
+		struct tile &t = tiles[i];
+		t.index = i;
+		t.center = voronoi.centers[i];
+		t.frontier = false;
+		t.land = false;
+		t.coast = false;
+		t.river = false;
+		t.relief = SEABED;
+		t.biome = SEA;
+		t.site = VACANT;
+		t.name = UNNAMED;
+		t.hold = -1;
+	}
+
+	corners.resize(voronoi.positions.size());
+	for (int i = 0; i < corners.size(); i++) {
+		struct corner &c = corners[i];
+		c.index = i;
+		c.position = voronoi.positions[i];
+		c.frontier = false;
+		c.coast = false;
+		c.river = false;
+		c.wall = false;
+		c.depth = 0;
+	}
 
-	tiles.resize(voronoi.cells.size());
-	corners.resize(voronoi.vertices.size());
+	// borders on the bounds of the diagram only have one cell, they use it on both sides
 	borders.resize(voronoi.edges.size());
-
-	// adopt cell structures
-	for (const auto &cell : voronoi.cells) {
-		std::vector<const struct tile*> tneighbors;
-		for (const auto &neighbor : cell.neighbors) {
-			tneighbors.push_back(&tiles[neighbor->index]);
-		}
-		std::vector<const struct corner*> tcorners;
-		for (const auto &vertex : cell.vertices) {
-			tcorners.push_back(&corners[vertex->index]);
+	for (const auto &edge : voronoi.edges) {
+		struct border &b = borders[edge.index];
+		b.index = edge.index;
+		b.c0 = edge.v0;
+		b.c1 = edge.v1;
+		b.coast = false;
+		b.river = false;
+		b.frontier = false;
+		b.wall = false;
+		if (edge.c0 >= 0) {
+			b.t0 = edge.c0;
+		} else {
+			b.t0 = edge.c1;
+			tiles[b.t0].frontier = true;
+			b.frontier = true;
+			corners[b.c0].frontier = true;
+			corners[b.c1].frontier = true;
 		}
-		std::vector<const struct border*> tborders;
-		for (const auto &edge : cell.edges) {
-			tborders.push_back(&borders[edge->index]);
+		if (edge.c1 >= 0) {
+			b.t1 = edge.c1;
+		} else {
+			b.t1 = edge.c0;
+			tiles[b.t1].frontier = true;
+			b.frontier = true;
+			corners[b.c0].frontier = true;
+			corners[b.c1].frontier = true;
 		}
-
-		struct tile t = {
-			.index = cell.index,
-			.center = cell.center,
-			.neighbors = tneighbors,
-			.corners = tcorners,
-			.borders = tborders,
-			.frontier = false,
-			.land = false,
-			.coast = false,
-			.river = false,
-			.relief = SEABED,
-			.biome = SEA,
-			.site = VACANT,
-			.name = "unnamed"
-		};
-
-		tiles[cell.index] = t;
 	}
 
-	// adapt vertex structures
-	for (const auto &vertex : voronoi.vertices) {
-		std::vector<struct corner*> adjacent;
-		for (const auto &neighbor : vertex.adjacent) {
-			adjacent.push_back(&corners[neighbor->index]);
-		}
-		std::vector<struct tile*> touches;
-		for (const auto &cell : vertex.cells) {
-			touches.push_back(&tiles[cell->index]);
-		}
+	link_borders(&graph, borders);
+}
 
-		struct corner c = {
-			.index = vertex.index,
-			.position = vertex.position,
-			.adjacent = adjacent,
-			.touches = touches,
-			.frontier = false,
-			.coast = false,
-			.river = false,
-			.wall = false,
-			.depth = 0
-		};
+// the slot of a node in the links of another node
+static inline size_t link_slot(const struct adjacency *graph, uint32_t node, uint32_t target)
+{
+	const struct span links = (*graph)[node];
+	size_t i = std::find(links.begin(), links.end(), target) - links.begin();
 
-		corners[vertex.index] = c;
-	}
+	return graph->offsets[node] + i;
+}
 
-	// adapt edge structures
-	for (const auto &edge : voronoi.edges) {
-		int index = edge.index;
-		borders[index].index = index;
-		borders[index].c0 = &corners[edge.v0->index];
-		borders[index].c1 = &corners[edge.v1->index];
-		borders[index].coast = false;
-		borders[index].river = false;
-		borders[index].frontier = false;
-		borders[index].wall = false;
-		if (edge.c0 != nullptr) {
-			borders[index].t0 = &tiles[edge.c0->index];
-		} else {
-			borders[index].t0 = &tiles[edge.c1->index];
-			borders[index].t0->frontier = true;
-			borders[index].frontier = true;
-			borders[index].c0->frontier = true;
-			borders[index].c1->frontier = true;
-		}
-		if (edge.c1 != nullptr) {
-			borders[index].t1 = &tiles[edge.c1->index];
-		} else {
-			borders[index].t1 = &tiles[edge.c0->index];
-			borders[index].t1->frontier = true;
-			borders[index].frontier = true;
-			borders[index].c0->frontier = true;
-			borders[index].c1->frontier = true;
+void link_borders(struct worldgraph *graph, const std::vector<struct border> &borders)
+{
+	graph->neighbor_borders.assign(graph->neighbors.links.size(), NO_BORDER);
+	graph->adjacent_borders.assign(graph->adjacent.links.size(), NO_BORDER);
+
+	for (const auto &b : borders) {
+		// frontier borders have the same tile on both sides
+		if (b.t0 != b.t1) {
+			size_t slot = link_slot(&graph->neighbors, b.t0, b.t1);
+			if (slot < graph->neighbors.offsets[b.t0+1]) { graph->neighbor_borders[slot] = b.index; }
+			slot = link_slot(&graph->neighbors, b.t1, b.t0);
+			if (slot < graph->neighbors.offsets[b.t1+1]) { graph->neighbor_borders[slot] = b.index; }
 		}
+		size_t slot = link_slot(&graph->adjacent, b.c0, b.c1);
+		if (slot < graph->adjacent.offsets[b.c0+1]) { graph->adjacent_borders[slot] = b.index; }
+		slot = link_slot(&graph->adjacent, b.c1, b.c0);
+		if (slot < graph->adjacent.offsets[b.c1+1]) { graph->adjacent_borders[slot] = b.index; }
 	}
 }
 
-void Worldmap::gen_biomes(void)
+// labels the terra timings so raster and sampled runs can be told apart
+static const char *terra_mode_name(enum TERRA_MODE mode)
+{
+	return (mode == TERRA_SAMPLED) ? "sampled" : "raster";
+}
+
+// tile centers in the image space of the terra maps
+std::vector<glm::vec2> Worldmap::terra_points(void) const
 {
-	std::mt19937 gen(seed);
 	const float scale_x = float(TERRA_IMAGE_RES) / area.max.x;
 	const float scale_y = float(TERRA_IMAGE_RES) / area.max.y;
-	for (struct tile &t : tiles) {
-		float warmth = sample_byteimage(scale_x*t.center.x, scale_y*t.center.y, RED, &terra.tempmap);
-		float rain = sample_byteimage(scale_x*t.center.x, scale_y*t.center.y, RED, &terra.rainmap);
-		enum TEMPERATURE temper = pick_temperature(warmth);
-		enum VEGETATION veg;
-		if (rain < 0.25f) {
-			veg = ARID;
-		} else {
-			float p = glm::smoothstep(0.25f, 0.6f, rain);
-			std::bernoulli_distribution d(p);
-			veg = d(gen) ? HUMID : DRY;
-		}
-		t.biome = pick_biome(t.relief, temper, veg);
-		if (t.biome == DESERT && t.relief == LOWLAND && t.river == true) {
-			t.biome = FLOODPLAIN;
-		}
-		// alpine biomes
-		if (t.relief == UPLAND) {
-			for (const auto &neighbor : t.neighbors) {
-				if (neighbor->relief == HIGHLAND) {
-					if (veg == DRY) {
-						t.biome = PINE_GRASSLAND;
-					} else if (veg == HUMID) {
-						t.biome = PINE_FOREST;
-					}
+
+	std::vector<glm::vec2> points(tiles.size());
+	for (const struct tile &t : tiles) {
+		points[t.index] = glm::vec2(scale_x*t.center.x, scale_y*t.center.y);
+	}
+
+	return points;
+}
+
+void Worldmap::gen_biomes(void)
+{
+	std::vector<float> warmths;
+	std::vector<float> rains;
+	auto start = std::chrono::steady_clock::now();
+	sample_terra(&terra, terra_points(), nullptr, &warmths, &rains);
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed_seconds = end-start;
+	std::cout << "biomes terra " << terra_mode_name(terra.mode) << " elapsed time: " << elapsed_seconds.count() << "s\n";
+
+	// flag the tiles next to mountains before any biome is written
+	std::vector<uint8_t> alpine(tiles.size(), false);
+	parallel_for(tiles.size(), TILE_BATCH, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			for (uint32_t neighbor : graph.neighbors[i]) {
+				if (tiles[neighbor].relief == HIGHLAND) {
+					alpine[i] = true;
 					break;
 				}
 			}
 		}
-	}
+	});
+
+	parallel_for(tiles.size(), TILE_BATCH, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			struct tile &t = tiles[i];
+			enum TEMPERATURE temper = pick_temperature(warmths[i]);
+			enum VEGETATION veg = ARID;
+			float rain = rains[i];
+			if (rain >= 0.25f) {
+				float p = glm::smoothstep(0.25f, 0.6f, rain);
+				veg = random_chance(seed, RANDOM_BIOMES, t.index, p) ? HUMID : DRY;
+			}
+			t.biome = BIOME_TABLE.biomes[t.river][alpine[i]][t.relief][temper][veg];
+		}
+	});
 }
 
-void Worldmap::gen_relief(const struct byteimage *heightmap)
+void Worldmap::gen_relief(void)
 {
-	const float scale_x = float(TERRA_IMAGE_RES) / area.max.x;
-	const float scale_y = float(TERRA_IMAGE_RES) / area.max.y;
+	std::vector<float> heights;
+	auto start = std::chrono::steady_clock::now();
+	sample_terra(&terra, terra_points(), &heights, nullptr, nullptr);
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed_seconds = end-start;
+	std::cout << "relief terra " << terra_mode_name(terra.mode) << " elapsed time: " << elapsed_seconds.count() << "s\n";
+
 	for (struct tile &t : tiles) {
-		float height = sample_byteimage(scale_x*t.center.x, scale_y*t.center.y, RED, heightmap);
+		float height = heights[t.index];
 		t.land = (height < params.lowland) ? false : true;
 		if (height < params.lowland) { 
 			t.relief = SEABED;
@@ -321,16 +463,23 @@ void Worldmap::gen_relief(const struct byteimage *heightmap)
 	floodfill_relief(MIN_MOUNTAIN_BODY, HIGHLAND, UPLAND);
 	remove_echoriads();
 
+	// label the landmasses and seas
+	std::vector<uint8_t> classes(tiles.size());
+	for (const struct tile &t : tiles) {
+		classes[t.index] = t.land ? 2 : 1;
+	}
+	label_components(&graph.neighbors, classes, &bodies);
+
 	// find coastal tiles
 	for (auto &b : borders) {
 		// use XOR to determine if land is different
-		b.coast = b.t0->land ^ b.t1->land;
+		b.coast = tiles[b.t0].land ^ tiles[b.t1].land;
 
 		if (b.coast == true) {
-			b.c0->coast = b.coast;
-			b.c1->coast = b.coast;
-			b.t0->coast = b.coast;
-			b.t1->coast = b.coast;
+			corners[b.c0].coast = b.coast;
+			corners[b.c1].coast = b.coast;
+			tiles[b.t0].coast = b.coast;
+			tiles[b.t1].coast = b.coast;
 		}
 	}
 
@@ -344,10 +493,10 @@ void Worldmap::correct_walls(void)
 		c.wall = false;
 		bool walkable = false;
 		bool nearmountain = false;
-		for (const auto &t : c.touches) {
-			if (t->relief == HIGHLAND)  {
+		for (uint32_t t : graph.touches[c.index]) {
+			if (tiles[t].relief == HIGHLAND)  {
 				nearmountain = true;
-			} else if (t->relief == UPLAND || t->relief == LOWLAND) {
+			} else if (tiles[t].relief == UPLAND || tiles[t].relief == LOWLAND) {
 				walkable = true;
 			}
 		}
@@ -359,117 +508,80 @@ void Worldmap::correct_walls(void)
 		}
 	}
 	for (auto &b : borders) {
-		if (b.frontier && (b.t0->relief == HIGHLAND || b.t1->relief == HIGHLAND)) {
+		const struct tile &t0 = tiles[b.t0];
+		const struct tile &t1 = tiles[b.t1];
+		if (b.frontier && (t0.relief == HIGHLAND || t1.relief == HIGHLAND)) {
 			b.wall = true;
 		} else {
-			b.wall = (b.t0->relief == HIGHLAND) ^ (b.t1->relief == HIGHLAND);
+			b.wall = (t0.relief == HIGHLAND) ^ (t1.relief == HIGHLAND);
 		}
 	}
 }
 
 void Worldmap::floodfill_relief(unsigned int minsize, enum RELIEF target, enum RELIEF replacement)
 {
-	std::unordered_map<const struct tile*, bool> umap;
-	for (struct tile &t : tiles) {
-		umap[&t] = false;
-	}
-
-	for (struct tile &root : tiles) {
-		std::vector<struct tile*> marked;
-		if (umap[&root] == false && root.relief == target) {
-			std::queue<const struct tile*> queue;
-			umap[&root] = true;
-			queue.push(&root);
-			marked.push_back(&root);
-
-			while (queue.empty() == false) {
-				const struct tile *v = queue.front();
-				queue.pop();
-
-				for (const auto &neighbor : v->neighbors) {
-					if (umap[neighbor] == false) {
-						umap[neighbor] = true;
-						if (neighbor->relief == target) {
-							queue.push(neighbor);
-							marked.push_back(&tiles[neighbor->index]);
-						}
-					}
-				}
-			}
-		}
+	std::vector<uint8_t> classes(tiles.size());
+	for (const struct tile &t : tiles) {
+		classes[t.index] = t.relief == target;
+	}
+	struct components bodies;
+	label_components(&graph.neighbors, classes, &bodies);
 
-		if (marked.size() > 0 && marked.size() < minsize) {
-			for (struct tile *t : marked) {
-				t->relief = replacement;
-				if (target == SEABED) {
-					t->land = true;
-				}
+	for (struct tile &t : tiles) {
+		uint32_t body = bodies.label[t.index];
+		if (body != NO_COMPONENT && bodies.size[body] < minsize) {
+			t.relief = replacement;
+			if (target == SEABED) {
+				t.land = true;
 			}
 		}
 	}
 }
 
 // removes encircling mountains from the worldmap
-// uses a slightly different version of the floodfill algorithm
+// lowland and upland regions that don't touch water are turned into mountains
 void Worldmap::remove_echoriads(void)
 {
 	// add extra mountains to borders of the map
-	std::unordered_map<const struct tile*, bool> marked;
+	std::vector<bool> mountains(tiles.size(), false);
 	for (struct tile &t : tiles) {
-		marked[&t] = false;
 		if (t.frontier && (t.relief == LOWLAND || t.relief == UPLAND)) {
-			for (const auto neighbor : t.neighbors) {
-				if (neighbor->relief == HIGHLAND) {
-					marked[&t] = true;
+			for (uint32_t neighbor : graph.neighbors[t.index]) {
+				if (tiles[neighbor].relief == HIGHLAND) {
+					mountains[t.index] = true;
 				}
 			}
 		}
 	}
 	for (struct tile &t : tiles) {
-		if (marked[&t]) {
+		if (mountains[t.index]) {
 			t.relief = HIGHLAND;
 		}
 	}
 
-	std::unordered_map<const struct tile*, bool> umap;
-	for (struct tile &t : tiles) {
-		umap[&t] = false;
-	}
-
-	for (struct tile &root : tiles) {
-		bool foundwater = false;
-		std::vector<struct tile*> marked;
-		bool target = (root.relief == LOWLAND) || (root.relief == UPLAND);
-		if (umap[&root] == false && target == true) {
-			std::queue<const struct tile*> queue;
-			umap[&root] = true;
-			queue.push(&root);
-			marked.push_back(&root);
-
-			while (queue.empty() == false) {
-				const struct tile *v = queue.front();
-				queue.pop();
-
-				for (const auto &neighbor : v->neighbors) {
-					if (neighbor->relief == SEABED) {
-						foundwater = true;
-						break;
-					}
-					if (umap[neighbor] == false) {
-						umap[neighbor] = true;
-						if (neighbor->relief == LOWLAND || neighbor->relief == UPLAND) {
-							queue.push(neighbor);
-							marked.push_back(&tiles[neighbor->index]);
-						}
-					}
-				}
-			}
+	std::vector<uint8_t> classes(tiles.size());
+	for (const struct tile &t : tiles) {
+		classes[t.index] = (t.relief == LOWLAND) || (t.relief == UPLAND);
+	}
+	struct components regions;
+	label_components(&graph.neighbors, classes, &regions);
+
+	std::vector<bool> foundwater(regions.size.size(), false);
+	for (const struct border &b : borders) {
+		uint32_t r0 = regions.label[b.t0];
+		uint32_t r1 = regions.label[b.t1];
+		if (r0 != NO_COMPONENT && tiles[b.t1].relief == SEABED) {
+			foundwater[r0] = true;
 		}
+		if (r1 != NO_COMPONENT && tiles[b.t0].relief == SEABED) {
+			foundwater[r1] = true;
+		}
+	}
 
-		if (marked.size() > 0 && foundwater == false) {
-			for (struct tile *t : marked) {
-				t->relief = HIGHLAND;
-			}
+	for (struct tile &t : tiles) {
+		uint32_t region = regions.label[t.index];
+		if (region != NO_COMPONENT && foundwater[region] == false) {
+			t.relief = HIGHLAND;
 		}
 	}
 }
@@ -477,32 +589,20 @@ void Worldmap::remove_echoriads(void)
 void Worldmap::correct_border_rivers(void)
 {
 	// link the borders with the river corners
-	std::map<std::pair<int, int>, struct border*> link;
 	for (auto &b : borders) {
 		b.river = false;
-		link[std::minmax(b.c0->index, b.c1->index)] = &b;
 	}
 
-	for (const auto &bas : basins) {
-		if (bas.mouth != nullptr) {
-			std::queue<struct branch*> queue;
-			queue.push(bas.mouth);
-			while (!queue.empty()) {
-				struct branch *cur = queue.front();
-				queue.pop();
-				corners[cur->confluence->index].river = true;
-				corners[cur->confluence->index].depth = cur->depth;
-				if (cur->right != nullptr) {
-					struct border *bord = link[std::minmax(cur->confluence->index, cur->right->confluence->index)];
-					if (bord) { bord->river = true; }
-					queue.push(cur->right);
-				}
-				if (cur->left != nullptr) {
-					struct border *bord = link[std::minmax(cur->confluence->index, cur->left->confluence->index)];
-					if (bord) { bord->river = true; }
-					queue.push(cur->left);
-				}
-			}
+	for (const auto &cur : branches) {
+		corners[cur.confluence].river = true;
+		corners[cur.confluence].depth = cur.depth;
+		if (cur.right != NO_BRANCH) {
+			uint32_t bord = corner_border(&graph, cur.confluence, branches[cur.right].confluence);
+			if (bord != NO_BORDER) { borders[bord].river = true; }
+		}
+		if (cur.left != NO_BRANCH) {
+			uint32_t bord = corner_border(&graph, cur.confluence, branches[cur.left].confluence);
+			if (bord != NO_BORDER) { borders[bord].river = true; }
 		}
 	}
 }
@@ -511,32 +611,32 @@ void Worldmap::gen_rivers(void)
 {
 	// construct the drainage basin candidate graph
 	// only land and coast corners not on the edge of the map can be candidates for the graph
-	std::vector<const struct corner*> graph;
+	std::vector<uint32_t> candidates;
 	for (auto &c : corners) {
 		if (c.coast && c.frontier == false) {
-			graph.push_back(&c);
+			candidates.push_back(c.index);
 			c.river = true;
 		} else {
 			bool land = true;
-			for (const auto &t : c.touches) {
-				if (t->relief == SEABED) {
+			for (uint32_t t : graph.touches[c.index]) {
+				if (tiles[t].relief == SEABED) {
 					land = false;
 					break;
 				}
 			}
 			if (land && c.frontier == false) {
-				graph.push_back(&c);
+				candidates.push_back(c.index);
 				c.river = true;
 			}
 		}
 	}
 
-	gen_drainage_basins(graph);
+	gen_drainage_basins(candidates);
 
 	// assign stream order numbers
-	for (auto &bas : basins) {
-		stream_postorder(&bas);
-	}
+	for_each_basin(basins, [&](const struct basin *bas) {
+		stream_postorder(branches, bas);
+	});
 
 	if (params.erodmountains == true) {
 		erode_mountains();
@@ -554,14 +654,16 @@ void Worldmap::gen_rivers(void)
 	// remove rivers too close to each other
 	for (auto &b : borders) {
 		if (b.river == false && b.coast == false) {
-			float d = glm::distance(b.c0->position, b.c1->position);
+			struct corner &c0 = corners[b.c0];
+			struct corner &c1 = corners[b.c1];
+			float d = glm::distance(c0.position, c1.position);
 			// river with the smallest stream order is trimmed
 			// if they have the same stream order do a coin flip
-			if (b.c0->river == true && b.c1->river == true && d < MIN_RIVER_DIST) {
-				if (b.c0->depth > b.c1->depth) {
-					b.c1->river = false;
+			if (c0.river == true && c1.river == true && d < MIN_RIVER_DIST) {
+				if (c0.depth > c1.depth) {
+					c1.river = false;
 				} else {
-					b.c0->river = false;
+					c0.river = false;
 				}
 			}
 		}
@@ -569,47 +671,21 @@ void Worldmap::gen_rivers(void)
 	}
 	// remove rivers too close to map edges
 	for (auto &c : corners) {
-		for (const auto &adj : c.adjacent) {
-			if (adj->frontier == true || adj->wall == true) {
+		for (uint32_t adj : graph.adjacent[c.index]) {
+			if (corners[adj].frontier == true || corners[adj].wall == true) {
 				c.river = false;
 				break;
 			}
 		}
 	}
 	// trim basin
-	for (auto it = basins.begin(); it != basins.end(); ) {
-		struct basin &bas = *it;
-		std::queue<struct branch*> queue;
-		queue.push(bas.mouth);
-		while (!queue.empty()) {
-			struct branch *cur = queue.front();
-			queue.pop();
-
-			if (cur->right != nullptr) {
-				if (cur->right->confluence->river == false) {
-					prune_branches(cur->right);
-					cur->right = nullptr;
-				} else {
-					queue.push(cur->right);
-				}
-			}
-			if (cur->left != nullptr) {
-				if (cur->left->confluence->river == false) {
-					prune_branches(cur->left);
-					cur->left = nullptr;
-				} else {
-					queue.push(cur->left);
-				}
-			}
-		}
-		if (bas.mouth->right == nullptr && bas.mouth->left == nullptr) {
-			delete bas.mouth;
-			bas.mouth = nullptr;
-			it = basins.erase(it);
-		} else {
-			++it;
-		}
-	}
+	std::vector<uint8_t> pruned(branches.size(), false);
+	for_each_basin(basins, [&](const struct basin *bas) {
+		prune_tributaries(branches, bas, pruned, [&](const struct branch *node) {
+			return corners[node->confluence].river == false;
+		});
+	});
+	compact_basins(branches, basins, pruned);
 
 	trim_stubby_rivers();
 
@@ -621,99 +697,158 @@ void Worldmap::gen_rivers(void)
 
 	for (auto &b : borders) {
 		if (b.river) {
-			b.t0->river = b.river;
-			b.t1->river = b.river;
+			tiles[b.t0].river = b.river;
+			tiles[b.t1].river = b.river;
 		}
 	}
 }
 
-void Worldmap::gen_drainage_basins(std::vector<const struct corner*> &graph)
+// flows from the coast upstream in order of increasing score, every corner is settled once
+// the score of a corner is the cheapest climb from the coast, leaving a corner costs its elevation plus one
+// water only flows downhill so a corner only drains into neighbors that aren't higher than itself
+// a confluence takes at most two tributaries, equal offers go to the lowest corner index
+void Worldmap::gen_drainage_basins(const std::vector<uint32_t> &candidates)
 {
-	struct meta {
-		bool visited;
-		int elevation;
-		int score;
-	};
-
-	std::unordered_map<const struct corner*, struct meta> umap;
-	for (auto node : graph) {
+	// corners outside the candidate graph are never settled and never join a basin
+	std::vector<int> elevation(corners.size(), 0);
+	int maxstep = 1;
+	for (auto node : candidates) {
 		int weight = 0;
-		for (const auto &t : node->touches) {
-			if (t->relief == UPLAND) {
+		for (uint32_t t : graph.touches[node]) {
+			if (tiles[t].relief == UPLAND) {
 				weight += 3;
-			} else if (t->relief == HIGHLAND) {
+			} else if (tiles[t].relief == HIGHLAND) {
 				weight += 4;
 			}
 		}
-		struct meta data = {
-			.visited = false,
-			.elevation = weight,
-			.score = 0
-		};
-		umap[node] = data;
-	}
-
-	// breadth first search
-	for (auto root : graph) {
-		if (root->coast) {
-			std::queue<const struct corner*> frontier;
-			umap[root].visited = true;
-			frontier.push(root);
-			while (!frontier.empty()) {
-				const struct corner *v = frontier.front();
-				frontier.pop();
-				struct meta &vdata = umap[v];
-				int depth = vdata.score + vdata.elevation + 1;
-				for (auto neighbor : v->adjacent) {
-					if (neighbor->river == true && neighbor->coast == false) {
-						struct meta &ndata = umap[neighbor];
-						if (ndata.visited == false) {
-							ndata.visited = true;
-							ndata.score = depth;
-							frontier.push(neighbor);
-						} else if (ndata.score > depth && ndata.elevation >= vdata.elevation) {
-							ndata.score = depth;
-							frontier.push(neighbor);
+		elevation[node] = weight;
+		maxstep = std::max(maxstep, weight + 1);
+	}
+
+	// scores only grow by small steps so a ring of buckets one step wide works as priority queue
+	size_t nbuckets = 1;
+	while (nbuckets <= maxstep) { nbuckets <<= 1; }
+	std::vector<std::vector<uint32_t>> buckets(nbuckets);
+	std::vector<uint32_t> level;
+	size_t pending = 0;
+
+	begin_traversal(&walk, corners.size());
+	std::vector<int> score(corners.size(), INT_MAX);
+	std::vector<uint32_t> parent(corners.size(), UINT32_MAX);
+	std::vector<uint8_t> tributaries(corners.size(), 0);
+
+	for (auto root : candidates) {
+		if (corners[root].coast) {
+			score[root] = 0;
+			buckets[0].push_back(root);
+			pending++;
+		}
+	}
+
+	for (int current = 0; pending > 0; current++) {
+		// visit the corners of a level in index order so the result doesn't depend on the push order
+		level.swap(buckets[current & (nbuckets - 1)]);
+		pending -= level.size();
+		std::sort(level.begin(), level.end());
+		level.erase(std::unique(level.begin(), level.end()), level.end());
+
+		for (uint32_t node : level) {
+			if (marked(&walk.visited, node) || score[node] != current) { continue; }
+
+			if (corners[node].coast == false) {
+				// pick the cheapest downstream neighbor that can still take a tributary
+				uint32_t best = UINT32_MAX;
+				int cost = INT_MAX;
+				for (uint32_t neighbor : graph.adjacent[node]) {
+					if (marked(&walk.visited, neighbor) && tributaries[neighbor] < 2 && elevation[neighbor] <= elevation[node]) {
+						int offer = score[neighbor] + elevation[neighbor] + 1;
+						if (offer < cost || (offer == cost && neighbor < best)) {
+							cost = offer;
+							best = neighbor;
 						}
 					}
 				}
+				if (best == UINT32_MAX) {
+					// every neighbor is full, corners settled later may still reach this one
+					score[node] = INT_MAX;
+					continue;
+				}
+				if (cost > current) {
+					score[node] = cost;
+					buckets[cost & (nbuckets - 1)].push_back(node);
+					pending++;
+					continue;
+				}
+				parent[node] = best;
+				tributaries[best]++;
+			}
+
+			mark(&walk.visited, node);
+			int step = current + elevation[node] + 1;
+			for (uint32_t neighbor : graph.adjacent[node]) {
+				const struct corner &c = corners[neighbor];
+				if (c.river && c.coast == false && marked(&walk.visited, neighbor) == false) {
+					if (elevation[neighbor] >= elevation[node] && step < score[neighbor]) {
+						score[neighbor] = step;
+						buckets[step & (nbuckets - 1)].push_back(neighbor);
+						pending++;
+					}
+				}
 			}
 		}
+		level.clear();
 	}
 
-	// create the drainage basin binary tree
-	for (auto node : graph) {
-		umap[node].visited = false;
-	}
-	for (auto root : graph) {
-		if (root->coast) {
-			umap[root].visited = true;
-			struct basin basn;
-			struct branch *mouth = insert(root);
-			basn.mouth = mouth;
-			std::queue<struct branch*> frontier;
-			frontier.push(mouth);
-			while (!frontier.empty()) {
-				struct branch *fork = frontier.front();
-				const struct corner *v = fork->confluence;
-				frontier.pop();
-				struct meta &vdata = umap[v];
-				for (auto neighbor : v->adjacent) {
-					struct meta &ndata = umap[neighbor];
-					bool valid = ndata.visited == false && neighbor->coast == false;
-					if (valid) {
-						if (ndata.score > vdata.score && ndata.elevation >= vdata.elevation) {
-							ndata.visited = true;
-							struct branch *child = insert(neighbor);
-							frontier.push(child);
-							if (fork->left == nullptr) {
-								fork->left = child;
-							} else if (fork->right == nullptr) {
-								fork->right = child;
-							}
+	// create the drainage basin binary trees
+	// tributaries are attached in the order they appear around the confluence
+	reset_marker(&walk.visited, corners.size());
+	std::vector<uint32_t> upleft(corners.size(), UINT32_MAX);
+	std::vector<uint32_t> upright(corners.size(), UINT32_MAX);
+	std::vector<uint32_t> slot(corners.size());
+	std::vector<uint32_t> order;
+	std::vector<uint32_t> stack;
+	for (auto root : candidates) {
+		if (corners[root].coast) {
+			// depth first with the right tributary first gives the reverse post order
+			order.clear();
+			stack.push_back(root);
+			mark(&walk.visited, root);
+			while (!stack.empty()) {
+				uint32_t v = stack.back();
+				stack.pop_back();
+				order.push_back(v);
+				for (uint32_t neighbor : graph.adjacent[v]) {
+					if (parent[neighbor] == v && mark(&walk.visited, neighbor)) {
+						if (upleft[v] == UINT32_MAX) {
+							upleft[v] = neighbor;
+						} else {
+							upright[v] = neighbor;
 						}
 					}
 				}
+				if (upleft[v] != UINT32_MAX) { stack.push_back(upleft[v]); }
+				if (upright[v] != UINT32_MAX) { stack.push_back(upright[v]); }
+			}
+
+			struct basin basn;
+			basn.first = branches.size();
+			for (auto it = order.rbegin(); it != order.rend(); ++it) {
+				slot[*it] = branches.size();
+				struct branch node;
+				node.confluence = *it;
+				branches.push_back(node);
+			}
+			basn.mouth = branches.size() - 1;
+			for (uint32_t i = basn.first; i <= basn.mouth; i++) {
+				struct branch &node = branches[i];
+				if (upleft[node.confluence] != UINT32_MAX) {
+					node.left = slot[upleft[node.confluence]];
+					branches[node.left].parent = i;
+				}
+				if (upright[node.confluence] != UINT32_MAX) {
+					node.right = slot[upright[node.confluence]];
+					branches[node.right].parent = i;
+				}
 			}
 			basins.push_back(basn);
 		}
@@ -727,167 +862,100 @@ static bool prunable(const struct branch *node)
 	return false;
 }
 
+// basins touch distinct corners so the corners to erode around are flagged in parallel
+// the tiles are lowered afterwards so the shared tiles are written only once
 void Worldmap::erode_mountains(void)
 {
-	for (auto it = basins.begin(); it != basins.end(); ) {
-		struct basin &bas = *it;
-		std::queue<struct branch*> queue;
-		queue.push(bas.mouth);
-		while (!queue.empty()) {
-			struct branch *cur = queue.front();
-			queue.pop();
-
-			for (const auto t : cur->confluence->touches) {
-				if (t->relief == HIGHLAND && cur->streamorder > 2) { 
-					t->relief = UPLAND; 
-				}
-			}
-
-			if (cur->right != nullptr) {
-				queue.push(cur->right);
-			}
-			if (cur->left != nullptr) {
-				queue.push(cur->left);
+	std::vector<uint8_t> eroding(corners.size(), false);
+	for_each_basin(basins, [&](const struct basin *bas) {
+		for (uint32_t i = bas->first; i <= bas->mouth; i++) {
+			if (branches[i].streamorder > 2) {
+				eroding[branches[i].confluence] = true;
 			}
 		}
-		++it;
-	}
+	});
+
+	erode_highlands(tiles, &graph, eroding);
 }
 
 void Worldmap::trim_river_basins(void)
 {
 	// prune binary tree branch if the stream order is too low
-	for (auto it = basins.begin(); it != basins.end(); ) {
-		struct basin &bas = *it;
-		std::queue<struct branch*> queue;
-		queue.push(bas.mouth);
-		while (!queue.empty()) {
-			struct branch *cur = queue.front();
-			queue.pop();
-
-			if (params.erodmountains == true) {
-				for (const auto t : cur->confluence->touches) {
-					if (t->relief == HIGHLAND) { 
-						t->relief = UPLAND; 
-					}
-				}
-			}
-
-			if (cur->right != nullptr) {
-				if (prunable(cur->right)) {
-					prune_branches(cur->right);
-					cur->right = nullptr;
-				} else {
-					queue.push(cur->right);
-				}
-			}
-			if (cur->left != nullptr) {
-				if (prunable(cur->left)) {
-					prune_branches(cur->left);
-					cur->left = nullptr;
-				} else {
-					queue.push(cur->left);
+	std::vector<uint8_t> pruned(branches.size(), false);
+	std::vector<uint8_t> eroding(corners.size(), false);
+	for_each_basin(basins, [&](const struct basin *bas) {
+		prune_tributaries(branches, bas, pruned, prunable);
+		if (params.erodmountains == true) {
+			for (uint32_t i = bas->first; i <= bas->mouth; i++) {
+				if (pruned[i] == false) {
+					eroding[branches[i].confluence] = true;
 				}
 			}
 		}
-		if (bas.mouth->right == nullptr && bas.mouth->left == nullptr) {
-			delete bas.mouth;
-			bas.mouth = nullptr;
-			it = basins.erase(it);
-		} else {
-			++it;
-		}
+	});
+
+	if (params.erodmountains == true) {
+		erode_highlands(tiles, &graph, eroding);
 	}
+
+	compact_basins(branches, basins, pruned);
 }
 
 void Worldmap::trim_stubby_rivers(void)
 {
-	std::unordered_map<const struct branch*, int> depth;
-	std::unordered_map<const struct branch*, bool> removable;
-	std::unordered_map<struct branch*, struct branch*> parents;
-	std::vector<struct branch*> endnodes;
-
-	// find river end nodes
-	for (auto it = basins.begin(); it != basins.end(); ) {
-		struct basin &bas = *it;
-		std::queue<struct branch*> queue;
-		queue.push(bas.mouth);
-		parents[bas.mouth] = nullptr;
-		removable[bas.mouth] = false;
-		while (!queue.empty()) {
-			struct branch *cur = queue.front();
-			depth[cur] = -1;
-			queue.pop();
-			if (cur->right == nullptr && cur->left == nullptr) {
-				endnodes.push_back(cur);
-				depth[cur] = 0;
-			} else {
-				if (cur->right != nullptr) { 
-					queue.push(cur->right); 
-					parents[cur->right] = cur;
-				}
-				if (cur->left != nullptr) { 
-					queue.push(cur->left); 
-					parents[cur->left] = cur;
-				}
+	std::vector<int> depth(branches.size(), -1);
+	std::vector<uint8_t> removable(branches.size(), false);
+	std::vector<uint8_t> pruned(branches.size(), false);
+
+	for_each_basin(basins, [&](const struct basin *bas) {
+		// find river end nodes
+		for (uint32_t i = bas->first; i <= bas->mouth; i++) {
+			if (branches[i].left == NO_BRANCH && branches[i].right == NO_BRANCH) {
+				depth[i] = 0;
 			}
-
 		}
-		++it;
-	}
-
-	// starting from end nodes assign depth to nodes until they reach a branch
-	for (auto &node : endnodes) {
-		std::queue<struct branch*> queue;
-		queue.push(node);
-		while (!queue.empty()) {
-			struct branch *cur = queue.front();
-			queue.pop();
-			struct branch *parent = parents[cur];
-			if (parent) {
-				depth[parent] = depth[cur] + 1;
-				if (parent->left != nullptr && parent->right != nullptr) { 
-				// reached a branch
-					if (depth[cur] > -1 && depth[cur] < 2) {
-						prune_branches(cur);
-						if (cur == parent->left) {
-							parent->left = nullptr;
-						} else if (cur == parent->right) {
-							parent->right = nullptr;
+
+		// starting from end nodes assign depth to nodes until they reach a branch
+		for (uint32_t node = bas->first; node <= bas->mouth; node++) {
+			if (depth[node] != 0 || pruned[node]) { continue; }
+			uint32_t cur = node;
+			while (true) {
+				uint32_t parent = branches[cur].parent;
+				if (parent != NO_BRANCH) {
+					depth[parent] = depth[cur] + 1;
+					if (branches[parent].left != NO_BRANCH && branches[parent].right != NO_BRANCH) { 
+					// reached a branch
+						if (depth[cur] > -1 && depth[cur] < 2) {
+							prune_branch(branches, pruned, cur);
 						}
+						break;
 					}
+					cur = parent;
 				} else {
-					queue.push(parent); 
+					if (depth[cur] < 4) { 
+					// reached the river mouth
+					// river is simply too small so mark it for deletion
+						removable[cur] = true;
+					}
+					break;
 				}
-			} else if (depth[cur] < 4) { 
-			// reached the river mouth
-			// river is simply too small so mark it for deletion
-				removable[cur] = true;
 			}
 		}
-	}
 
-	// remove river basins if they are too small
-	for (auto it = basins.begin(); it != basins.end(); ) {
-		struct basin &bas = *it;
-		if (removable[bas.mouth]) {
-			delete_basin(&bas);
-			it = basins.erase(it);
-		} else {
-			it++;
+		// remove river basins if they are too small
+		if (removable[bas->mouth]) {
+			std::fill(pruned.begin() + bas->first, pruned.begin() + bas->mouth + 1, true);
 		}
-	}
+	});
+
+	compact_basins(branches, basins, pruned);
 }
 
 void Worldmap::gen_sites(void) 
 {
 	// add candidate tiles that can have a site on them
-	std::unordered_map<const struct tile*, bool> visited;
-	std::unordered_map<const struct tile*, int> depth;
-	std::vector<struct tile*> candidates;
+	std::vector<uint32_t> candidates;
 	for (auto &t : tiles) {
-		visited[&t] = false;
-		depth[&t] = 0;
 		if (t.land == true && t.frontier == false && t.relief != HIGHLAND) {
 			switch (t.biome) {
 			case STEPPE :
@@ -896,101 +964,104 @@ void Worldmap::gen_sites(void)
 			case SAVANNA :
 			case SHRUBLAND :
 			case FLOODPLAIN :
-				candidates.push_back(&t);
+				candidates.push_back(t.index);
 			}
 		}
 	}
 
-	// first priority goes to castles
-	spawn_towns(candidates, visited, depth);
+	if (params.hopspacing) {
+		// first priority goes to towns
+		begin_traversal(&walk, tiles.size());
+		spawn_towns(tiles, corners, &graph, candidates, &walk);
 
-	// second priority goes to castles
-	spawn_castles(candidates, visited, depth);
+		// second priority goes to castles
+		spawn_castles(tiles, &graph, candidates, &walk);
+	} else {
+		place_towns(tiles, corners, &graph, candidates);
+		place_castles(tiles, candidates);
+	}
 
 	// third priority to villages
-	spawn_villages(candidates, visited, depth, seed);
+	spawn_villages(tiles, &graph, candidates, seed);
 
 	// reject sites based on chance if they're in harsh biomes
-	std::mt19937 gen(seed);
-	for (auto root : candidates) {
-		if (root->site != VACANT && root->biome == STEPPE) {
-			if (root->site == TOWN) {
-				root->site = VACANT;
-			} else {
-				float p = root->site == VILLAGE ? 0.25f : 0.75f;
-				std::bernoulli_distribution d(p);
-				if (d(gen) == false) {
+	parallel_for(candidates.size(), TILE_BATCH, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			struct tile *root = &tiles[candidates[i]];
+			if (root->site != VACANT && root->biome == STEPPE) {
+				if (root->site == TOWN) {
 					root->site = VACANT;
+				} else {
+					float p = root->site == VILLAGE ? 0.25f : 0.75f;
+					if (random_chance(seed, RANDOM_SITES, root->index, p) == false) {
+						root->site = VACANT;
+					}
 				}
 			}
 		}
-	}
+	});
 }
 
 void Worldmap::gen_holds(void) 
 {
 	int index = 0;
-	std::vector<struct tile*> candidates;
-	std::unordered_map<const struct tile*, bool> visited;
-	std::unordered_map<const struct tile*, int> depth;
 	for (auto &t : tiles) {
-		visited[&t] = false;
-		depth[&t] = 0;
 		if (t.site == TOWN || t.site == CASTLE) {
-			candidates.push_back(&t);
 			struct holding hold;
 			hold.index = index++;
-			hold.name = "unnamed";
-			hold.center = &t;
+			hold.name = UNNAMED;
+			hold.center = t.index;
 			holdings.push_back(hold);
 		}
 	}
 
 	// find the nearest hold center for each tile
-	for (auto &hold : holdings) {
-		hold.center->hold = &hold; // mkay
-		std::queue<const struct tile*> queue;
-		queue.push(hold.center);
-		while (!queue.empty()) {
-			const struct tile *node = queue.front();
-			queue.pop();
-			int layer = depth[node] + 1;
-			for (auto border : node->borders) {
-				if (border->frontier == false && border->river == false) {
-					const struct tile *neighbor = border->t0 == node ? border->t1 : border->t0;
-					bool valid = neighbor->relief == LOWLAND || neighbor->relief == UPLAND;
-					if ((neighbor->site == VACANT || neighbor->site == VILLAGE) && valid == true) {
-						if (visited[neighbor] == false) {
-							visited[neighbor] = true;
-							depth[neighbor] = layer;
-							queue.push(neighbor);
-							tiles[neighbor->index].hold = &hold;
-						} else if (depth[neighbor] > layer) {
+	// all centers grow at once one layer at a time, a tile reached by several holds in the same layer goes to the lowest hold index
+	begin_traversal(&walk, tiles.size());
+	std::vector<int> &depth = walk.depth;
+	std::vector<uint32_t> &frontier = walk.found;
+	std::vector<uint32_t> next;
+	for (const auto &hold : holdings) {
+		tiles[hold.center].hold = hold.index;
+		mark(&walk.visited, hold.center);
+		frontier.push_back(hold.center);
+	}
+	for (int layer = 1; !frontier.empty(); layer++) {
+		for (uint32_t node : frontier) {
+			int owner = tiles[node].hold;
+			for (uint32_t bindex : graph.borders[node]) {
+				const struct border &border = borders[bindex];
+				if (border.frontier == false && border.river == false) {
+					uint32_t neighbor = border.t0 == node ? border.t1 : border.t0;
+					struct tile &n = tiles[neighbor];
+					bool valid = n.relief == LOWLAND || n.relief == UPLAND;
+					if ((n.site == VACANT || n.site == VILLAGE) && valid == true) {
+						if (mark(&walk.visited, neighbor)) {
 							depth[neighbor] = layer;
-							queue.push(neighbor);
-							tiles[neighbor->index].hold = &hold;
+							n.hold = owner;
+							next.push_back(neighbor);
+						} else if (depth[neighbor] == layer && owner < n.hold) {
+							n.hold = owner;
 						}
 					}
 				}
 			}
 		}
-	}
-
-	for (auto &t : tiles) {
-		if (t.hold != nullptr) {
-			t.hold->lands.push_back(&t);
-		}
-	}
-
-	// find neighbors
-	std::map<std::pair<int, int>, bool> link;
-	for (auto &bord : borders) {
-		if (bord.t0->hold != nullptr && bord.t1->hold != nullptr) {
-			if (bord.t0->hold != bord.t1->hold) {
-				if (link[std::minmax(bord.t0->hold->index, bord.t1->hold->index)] == false) {
-					link[std::minmax(bord.t0->hold->index, bord.t1->hold->index)] = true;
-					bord.t0->hold->neighbors.push_back(bord.t1->hold);
-					bord.t1->hold->neighbors.push_back(bord.t0->hold);
+		frontier.swap(next);
+		next.clear();
+	}
+
+	// gather the lands and neighbors of each hold in one sweep over the tiles
+	// holds only have a handful of neighbors so a linear search is enough to skip known ones
+	for (const auto &t : tiles) {
+		if (t.hold < 0) { continue; }
+		struct holding &hold = holdings[t.hold];
+		hold.lands.push_back(t.index);
+		for (uint32_t neighbor : graph.neighbors[t.index]) {
+			int other = tiles[neighbor].hold;
+			if (other >= 0 && other != t.hold) {
+				if (std::find(hold.neighbors.begin(), hold.neighbors.end(), other) == hold.neighbors.end()) {
+					hold.neighbors.push_back(other);
 				}
 			}
 		}
@@ -999,63 +1070,49 @@ void Worldmap::gen_holds(void)
 
 void Worldmap::name_holds(void)
 {
-	std::string pattern;
-
-	import_pattern("names/region.txt", pattern);
-
-	// valgrind detects a small memory leak here
-	NameGen::Generator generator(pattern.c_str());
+	std::vector<uint32_t> keys;
+	for (const auto &hold : holdings) {
+		keys.push_back(hold.index);
+	}
 
-	for (auto &hold : holdings) {
-		hold.name = generator.toString();
+	std::vector<uint32_t> handles;
+	generate_names(&regionnames, seed, RANDOM_HOLD_NAMES, keys, &names, handles);
+	for (size_t i = 0; i < holdings.size(); i++) {
+		holdings[i].name = handles[i];
 	}
 }
 
 void Worldmap::name_sites(void)
 {
-	std::string town;
-	std::string fort;
-	std::string village;
-
-	import_pattern("names/town.txt", town);
-	import_pattern("names/fort.txt", fort);
-	import_pattern("names/village.txt", village);
-
-	NameGen::Generator towngen(town.c_str());
-	NameGen::Generator fortgen(fort.c_str());
-	NameGen::Generator villagegen(village.c_str());
-
-	for (auto &t : tiles) {
-		switch (t.site) {
-		case TOWN : t.name = towngen.toString(); break;
-		case CASTLE : t.name = fortgen.toString(); break;
-		case VILLAGE : t.name = villagegen.toString(); break;
+	const struct namepattern *patterns[] = { &townnames, &fortnames, &villagenames };
+	const enum SITE kinds[] = { TOWN, CASTLE, VILLAGE };
+
+	std::vector<uint32_t> keys;
+	std::vector<uint32_t> handles;
+	for (int i = 0; i < 3; i++) {
+		keys.clear();
+		for (const auto &t : tiles) {
+			if (t.site == kinds[i]) { keys.push_back(t.index); }
+		}
+		// keyed by tile so every site draws from its own stream
+		generate_names(patterns[i], seed, RANDOM_SITE_NAMES, keys, &names, handles);
+		for (size_t j = 0; j < keys.size(); j++) {
+			tiles[keys[j]].name = handles[j];
 		}
 	}
 }
 
-static struct branch *insert(const struct corner *confluence)
-{
-	struct branch *node = new branch;
-	node->confluence = confluence;
-	node->left = nullptr;
-	node->right = nullptr;
-	node->streamorder = 1;
-
-	return node;
-}
-
 // Strahler stream order
 // https://en.wikipedia.org/wiki/Strahler_number
-static inline int strahler(const struct branch *node) 
+static inline int strahler(const std::vector<struct branch> &branches, const struct branch *node) 
 {
 	// if node has no children it is a leaf with stream order 1
-	if (node->left == nullptr && node->right == nullptr) {
+	if (node->left == NO_BRANCH && node->right == NO_BRANCH) {
 		return 1;
 	}
 
-	int left = (node->left != nullptr) ? node->left->streamorder : 0;
-	int right = (node->right != nullptr) ? node->right->streamorder : 0;
+	int left = (node->left != NO_BRANCH) ? branches[node->left].streamorder : 0;
+	int right = (node->right != NO_BRANCH) ? branches[node->right].streamorder : 0;
 
 	if (left == right) {
 		return std::max(left, right) + 1;
@@ -1066,154 +1123,146 @@ static inline int strahler(const struct branch *node)
 
 // Shreve stream order
 // https://en.wikipedia.org/wiki/Stream_order#Shreve_stream_order
-static inline int shreve(const struct branch *node) 
+static inline int shreve(const std::vector<struct branch> &branches, const struct branch *node) 
 {
 	// if node has no children it is a leaf with stream order 1
-	if (node->left == nullptr && node->right == nullptr) {
+	if (node->left == NO_BRANCH && node->right == NO_BRANCH) {
 		return 1;
 	}
 
-	int left = (node->left != nullptr) ? node->left->streamorder : 0;
-	int right = (node->right != nullptr) ? node->right->streamorder : 0;
+	int left = (node->left != NO_BRANCH) ? branches[node->left].streamorder : 0;
+	int right = (node->right != NO_BRANCH) ? branches[node->right].streamorder : 0;
 
 	return left + right;
 }
 
-static inline int postorder_level(struct branch *node)
+static inline int postorder_level(const std::vector<struct branch> &branches, const struct branch *node)
 {
-	if (node->left == nullptr && node->right == nullptr) {
-		return 0;
-	}
-
-	if (node->left != nullptr && node->right != nullptr) {
-		return std::max(node->left->depth, node->right->depth) + 1;
+	if (node->left != NO_BRANCH && node->right != NO_BRANCH) {
+		return std::max(branches[node->left].depth, branches[node->right].depth) + 1;
 	}
 
-	if (node->left) {
-		return node->left->depth + 1;
+	if (node->left != NO_BRANCH) {
+		return branches[node->left].depth + 1;
 	}
-	if (node->right) {
-		return node->right->depth + 1;
+	if (node->right != NO_BRANCH) {
+		return branches[node->right].depth + 1;
 	}
 
 	return 0;
 }
 
-// post order tree traversal
-static void stream_postorder(struct basin *tree)
+// runs a job for every basin on the worker pool
+// basins are handed out one at a time from the largest down so a single huge river doesn't end up last
+static void for_each_basin(const std::vector<struct basin> &basins, const std::function<void(const struct basin*)> &job)
 {
-	std::list<struct branch*> stack;
-	struct branch *prev = nullptr;
-	stack.push_back(tree->mouth);
-
-	while (!stack.empty()) {
-		struct branch *current = stack.back();
-
-		if (prev == nullptr || prev->left == current || prev->right == current) {
-			if (current->left != nullptr) {
-				stack.push_back(current->left);
-			} else if (current->right != nullptr) {
-				stack.push_back(current->right);
-			} else {
-				current->streamorder = strahler(current);
-				current->depth = postorder_level(current);
-				stack.pop_back();
-			}
-		} else if (current->left == prev) {
-			if (current->right != nullptr) {
-				stack.push_back(current->right);
-			} else {
-				current->streamorder = strahler(current);
-				current->depth = postorder_level(current);
-				stack.pop_back();
-			}
-		} else if (current->right == prev) {
-			current->streamorder = strahler(current);
-			current->depth = postorder_level(current);
-			stack.pop_back();
-		}
-
-		prev = current;
+	std::vector<uint32_t> schedule(basins.size());
+	for (uint32_t i = 0; i < schedule.size(); i++) {
+		schedule[i] = i;
 	}
+	std::stable_sort(schedule.begin(), schedule.end(), [&](uint32_t a, uint32_t b) {
+		return basins[a].mouth - basins[a].first > basins[b].mouth - basins[b].first;
+	});
+
+	parallel_for(schedule.size(), 1, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			job(&basins[schedule[i]]);
+		}
+	});
 }
 
-static void prune_branches(struct branch *root)
+// the branches are in post order so a single pass sees the tributaries before their confluence
+static void stream_postorder(std::vector<struct branch> &branches, const struct basin *bas)
 {
-	if (root == nullptr) { return; }
-
-	std::queue<struct branch*> queue;
-	queue.push(root);
-
-	struct branch *front = nullptr;
-
-	while (!queue.empty()) {
-		front = queue.front();
-		queue.pop();
-		if (front->left) { queue.push(front->left); }
-		if (front->right) { queue.push(front->right); }
-
-		delete front;
+	for (uint32_t i = bas->first; i <= bas->mouth; i++) {
+		struct branch &current = branches[i];
+		current.streamorder = strahler(branches, &current);
+		current.depth = postorder_level(branches, &current);
 	}
 }
 
-static void delete_basin(struct basin *tree)
+// marks the subtree of a branch as pruned and detaches it from its confluence
+// the subtree is the range that ends at the branch and starts at its first remaining leaf
+static void prune_branch(std::vector<struct branch> &branches, std::vector<uint8_t> &pruned, uint32_t node)
 {
-	if (tree->mouth == nullptr) { return; }
-
-	prune_branches(tree->mouth);
+	uint32_t first = node;
+	while (branches[first].left != NO_BRANCH || branches[first].right != NO_BRANCH) {
+		const struct branch &cur = branches[first];
+		first = (cur.left != NO_BRANCH) ? cur.left : cur.right;
+	}
+	std::fill(pruned.begin() + first, pruned.begin() + node + 1, true);
 
-	tree->mouth = nullptr;
+	uint32_t parent = branches[node].parent;
+	if (parent != NO_BRANCH) {
+		if (branches[parent].left == node) {
+			branches[parent].left = NO_BRANCH;
+		} else {
+			branches[parent].right = NO_BRANCH;
+		}
+	}
 }
 
-static enum TEMPERATURE pick_temperature(float warmth)
+// walks the tree down from its mouth and prunes the tributaries that match
+static void prune_tributaries(std::vector<struct branch> &branches, const struct basin *bas, std::vector<uint8_t> &pruned, const std::function<bool(const struct branch*)> &prunable)
 {
-	enum TEMPERATURE temperature = COLD;
-
-	if (warmth > 0.75f) {
-		temperature = WARM;
-	} else if (warmth < 0.25f) {
-		temperature = COLD;
-	} else {
-		temperature = TEMPERATE;
+	for (uint32_t i = bas->mouth + 1; i-- > bas->first; ) {
+		if (pruned[i]) { continue; }
+		const struct branch &cur = branches[i];
+		if (cur.right != NO_BRANCH && prunable(&branches[cur.right])) {
+			prune_branch(branches, pruned, cur.right);
+		}
+		if (cur.left != NO_BRANCH && prunable(&branches[cur.left])) {
+			prune_branch(branches, pruned, cur.left);
+		}
 	}
-
-	return temperature;
 }
 
-static enum BIOME pick_biome(enum RELIEF relief, enum TEMPERATURE temper, enum VEGETATION veg)
+// drops the pruned branches and basins left without tributaries, the post order layout is kept
+static void compact_basins(std::vector<struct branch> &branches, std::vector<struct basin> &basins, std::vector<uint8_t> &pruned)
 {
-	if (relief == SEABED) { return SEA; } // pretty obvious
-
-	// mountain biomes
-	if (relief == HIGHLAND) {
-		if (temper == WARM && veg == ARID) {
-			return BADLANDS;
-		} else {
-			return GLACIER;
+	std::vector<uint32_t> remap(branches.size(), NO_BRANCH);
+	uint32_t count = 0;
+	size_t nbasins = 0;
+	for (const auto &bas : basins) {
+		const struct branch &mouth = branches[bas.mouth];
+		if (pruned[bas.mouth] || (mouth.left == NO_BRANCH && mouth.right == NO_BRANCH)) {
+			continue;
+		}
+		struct basin kept;
+		kept.first = count;
+		for (uint32_t i = bas.first; i <= bas.mouth; i++) {
+			if (pruned[i] == false) {
+				remap[i] = count;
+				branches[count++] = branches[i];
+			}
 		}
+		kept.mouth = count - 1;
+		basins[nbasins++] = kept;
 	}
+	branches.resize(count);
+	basins.resize(nbasins);
 
-	if (temper == COLD) {
-		switch (veg) {
-		case ARID: return STEPPE;
-		case DRY: return PINE_GRASSLAND;
-		case HUMID: return PINE_FOREST;
-		};
-	} else if (temper == TEMPERATE) {
-		switch (veg) {
-		case ARID: return STEPPE;
-		case DRY: return BROADLEAF_GRASSLAND;
-		case HUMID: return BROADLEAF_FOREST;
-		};
-	} else if (temper == WARM) {
-		switch (veg) {
-		case ARID: return DESERT;
-		case DRY: return SAVANNA;
-		case HUMID: return SHRUBLAND;
-		};
+	for (auto &node : branches) {
+		if (node.parent != NO_BRANCH) { node.parent = remap[node.parent]; }
+		if (node.left != NO_BRANCH) { node.left = remap[node.left]; }
+		if (node.right != NO_BRANCH) { node.right = remap[node.right]; }
 	}
+}
 
-	return GLACIER; // the impossible happened
+// lowers the mountains around the flagged corners
+static void erode_highlands(std::vector<struct tile> &tiles, const struct worldgraph *graph, const std::vector<uint8_t> &eroding)
+{
+	parallel_for(tiles.size(), TILE_BATCH, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			if (tiles[i].relief != HIGHLAND) { continue; }
+			for (uint32_t c : graph->corners[i]) {
+				if (eroding[c]) {
+					tiles[i].relief = UPLAND;
+					break;
+				}
+			}
+		}
+	});
 }
 
 static struct worldparams import_noiseparams(const char *fpath)
@@ -1263,6 +1312,13 @@ static struct worldparams import_noiseparams(const char *fpath)
 
 	params.erodmountains = reader.GetBoolean("", "ERODABLE_MOUNTAINS", false);
 
+	params.hopspacing = reader.GetBoolean("", "SITE_HOP_SPACING", false);
+
+	long threads = reader.GetInteger("", "WORKER_THREADS", 0);
+	if (threads > 0) { params.threads = threads; }
+
+	params.sampledterra = reader.GetBoolean("", "SAMPLED_TERRA", false);
+
 	// lowland can't be higher than upland
 	// upland can't be higher than highland
 	std::array<float, 3> s = {params.lowland, params.upland, params.highland};
@@ -1274,32 +1330,30 @@ static struct worldparams import_noiseparams(const char *fpath)
 	return params;
 }
 
-static void spawn_towns(std::vector<struct tile*> &candidates, std::unordered_map<const struct tile*, bool> &visited, std::unordered_map<const struct tile*, int> &depth)
+static void spawn_towns(std::vector<struct tile> &tiles, const std::vector<struct corner> &corners, const struct worldgraph *graph, const std::vector<uint32_t> &candidates, struct traversal *walk)
 {
 	// use breadth first search to mark tiles within a certain radius around a site as visited so other sites won't spawn near them
 	// first priority goes to cities near the coast
-	for (auto root : candidates) {
-		if (root->river && root->coast && visited[root] == false) {
+	for (auto index : candidates) {
+		struct tile *root = &tiles[index];
+		if (root->river && root->coast && marked(&walk->visited, index) == false) {
 			bool valid = false;
-			for (auto c : root->corners) {
-				if (c->river && c->coast) {
+			for (uint32_t c : graph->corners[index]) {
+				if (corners[c].river && corners[c].coast) {
 					valid = true;
 					break;
 				}
 			}
 			if (valid == true) {
-				std::queue<const struct tile*> queue;
-				queue.push(root);
-				while (!queue.empty()) {
-					const struct tile *node = queue.front();
-					queue.pop();
-					int layer = depth[node] + 1;
-					for (auto neighbor : node->neighbors) {
-						if (visited[neighbor] == false) {
-							visited[neighbor] = true;
+				walk->queue.push(index);
+				while (!walk->queue.empty()) {
+					uint32_t node = walk->queue.pop();
+					int layer = walk->depth[node] + 1;
+					for (uint32_t neighbor : graph->neighbors[node]) {
+						if (mark(&walk->visited, neighbor)) {
 							if (layer < TOWN_SPAWN_RADIUS) {
-								depth[neighbor] = layer;
-								queue.push(neighbor);
+								walk->depth[neighbor] = layer;
+								walk->queue.push(neighbor);
 							}
 						}
 					}
@@ -1310,21 +1364,19 @@ static void spawn_towns(std::vector<struct tile*> &candidates, std::unordered_ma
 	}
 
 	// second priority goes to cities inland
-	for (auto root : candidates) {
-		if (root->river && visited[root] == false) {
+	for (auto index : candidates) {
+		struct tile *root = &tiles[index];
+		if (root->river && marked(&walk->visited, index) == false) {
 			bool valid = false;
-			std::queue<const struct tile*> queue;
-			queue.push(root);
-			while (!queue.empty()) {
-				const struct tile *node = queue.front();
-				queue.pop();
-				int layer = depth[node] + 1;
-				for (auto neighbor : node->neighbors) {
-					if (visited[neighbor] == false) {
-						visited[neighbor] = true;
+			walk->queue.push(index);
+			while (!walk->queue.empty()) {
+				uint32_t node = walk->queue.pop();
+				int layer = walk->depth[node] + 1;
+				for (uint32_t neighbor : graph->neighbors[node]) {
+					if (mark(&walk->visited, neighbor)) {
 						if (layer < TOWN_SPAWN_RADIUS) {
-							depth[neighbor] = layer;
-							queue.push(neighbor);
+							walk->depth[neighbor] = layer;
+							walk->queue.push(neighbor);
 						}
 					}
 				}
@@ -1338,43 +1390,176 @@ static void spawn_towns(std::vector<struct tile*> &candidates, std::unordered_ma
 	}
 }
 
-static void spawn_castles(std::vector<struct tile*> &candidates, std::unordered_map<const struct tile*, bool> &visited, std::unordered_map<const struct tile*, int> &depth)
+static void spawn_castles(std::vector<struct tile> &tiles, const struct worldgraph *graph, const std::vector<uint32_t> &candidates, struct traversal *walk)
 {
-	for (auto root : candidates) {
-		if (visited[root] == false) {
-			std::queue<const struct tile*> queue;
-			queue.push(root);
+	for (auto index : candidates) {
+		if (marked(&walk->visited, index) == false) {
+			walk->queue.push(index);
 			int max = 0;
-			while (!queue.empty()) {
-				const struct tile *node = queue.front();
-				queue.pop();
-				int layer = depth[node] + 1;
+			while (!walk->queue.empty()) {
+				uint32_t node = walk->queue.pop();
+				int layer = walk->depth[node] + 1;
 				if (layer > max) { max = layer; }
-				for (auto neighbor : node->neighbors) {
-					if (visited[neighbor] == false) {
-						visited[neighbor] = true;
+				for (uint32_t neighbor : graph->neighbors[node]) {
+					if (mark(&walk->visited, neighbor)) {
 						if (layer < CASTLE_SPAWN_RADIUS) {
-							depth[neighbor] = layer;
-							queue.push(neighbor);
+							walk->depth[neighbor] = layer;
+							walk->queue.push(neighbor);
 						}
 					}
 				}
 			}
 			if (max >= CASTLE_SPAWN_RADIUS) {
-				root->site = CASTLE;
+				tiles[index].site = CASTLE;
 			}
 		}
 	}
 }
 
-static void spawn_villages(std::vector<struct tile*> &candidates, std::unordered_map<const struct tile*, bool> &visited, std::unordered_map<const struct tile*, int> &depth, long seed)
+// uniform grid over the sites taken so far, cells are as wide as the spacing so a check only looks at the 3x3 cells around it
+// sites that are this far apart hold only a few per cell, so each check is constant time on average
+struct spatialgrid {
+	glm::vec2 min;
+	float cellsize;
+	int width;
+	int height;
+	std::vector<uint32_t> heads; // last site inserted in each cell
+	std::vector<uint32_t> next; // site inserted before it in the same cell
+	std::vector<glm::vec2> points;
+};
+
+static inline int grid_cell(const struct spatialgrid *grid, glm::vec2 p)
 {
-	std::mt19937 gen(seed);
-	for (auto root : candidates) {
+	p = glm::max(p, grid->min);
+	int x = std::min(int((p.x - grid->min.x) / grid->cellsize), grid->width - 1);
+	int y = std::min(int((p.y - grid->min.y) / grid->cellsize), grid->height - 1);
+
+	return y * grid->width + x;
+}
+
+// the grid covers the bounds of the candidates, points outside it are clamped to the border cells
+static void init_grid(struct spatialgrid *grid, const std::vector<glm::vec2> &bounds, float cellsize)
+{
+	glm::vec2 min = bounds.empty() ? glm::vec2(0.f) : bounds.front();
+	glm::vec2 max = min;
+	for (const auto &p : bounds) {
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+	grid->min = min;
+	grid->cellsize = cellsize;
+	grid->width = int((max.x - min.x) / cellsize) + 1;
+	grid->height = int((max.y - min.y) / cellsize) + 1;
+	grid->heads.assign(grid->width * grid->height, UINT32_MAX);
+	grid->next.clear();
+	grid->points.clear();
+}
+
+static void insert_grid(struct spatialgrid *grid, glm::vec2 p)
+{
+	int cell = grid_cell(grid, p);
+	grid->next.push_back(grid->heads[cell]);
+	grid->heads[cell] = grid->points.size();
+	grid->points.push_back(p);
+}
+
+// returns true if a site in the grid is closer than radius to p, radius can't be wider than a cell
+static bool near_grid(const struct spatialgrid *grid, glm::vec2 p, float radius)
+{
+	int cell = grid_cell(grid, p);
+	int cx = cell % grid->width;
+	int cy = cell / grid->width;
+	for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, grid->height - 1); y++) {
+		for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, grid->width - 1); x++) {
+			for (uint32_t i = grid->heads[y * grid->width + x]; i != UINT32_MAX; i = grid->next[i]) {
+				if (glm::distance(p, grid->points[i]) < radius) {
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+// spaces towns by distance, river mouths go first and inland river tiles after them
+// a candidate is taken unless an earlier taken town is too close
+static void place_towns(std::vector<struct tile> &tiles, const std::vector<struct corner> &corners, const struct worldgraph *graph, const std::vector<uint32_t> &candidates)
+{
+	std::vector<uint32_t> order;
+	std::vector<uint8_t> mouth(tiles.size(), false);
+	for (auto index : candidates) {
+		const struct tile &root = tiles[index];
+		if (root.river && root.coast) {
+			for (uint32_t c : graph->corners[index]) {
+				if (corners[c].river && corners[c].coast) {
+					mouth[index] = true;
+					order.push_back(index);
+					break;
+				}
+			}
+		}
+	}
+	for (auto index : candidates) {
+		if (tiles[index].river && mouth[index] == false) {
+			order.push_back(index);
+		}
+	}
+
+	std::vector<glm::vec2> points(order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		points[i] = tiles[order[i]].center;
+	}
+	struct spatialgrid grid;
+	init_grid(&grid, points, TOWN_SPAWN_DISTANCE);
+
+	for (size_t i = 0; i < order.size(); i++) {
+		if (near_grid(&grid, points[i], TOWN_SPAWN_DISTANCE) == false) {
+			insert_grid(&grid, points[i]);
+			tiles[order[i]].site = TOWN;
+		}
+	}
+}
+
+// spaces castles by distance, away from the towns and from each other
+static void place_castles(std::vector<struct tile> &tiles, const std::vector<uint32_t> &candidates)
+{
+	std::vector<glm::vec2> points(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		points[i] = tiles[candidates[i]].center;
+	}
+
+	struct spatialgrid towngrid;
+	init_grid(&towngrid, points, TOWN_SPAWN_DISTANCE);
+	for (const auto &t : tiles) {
+		if (t.site == TOWN) { insert_grid(&towngrid, t.center); }
+	}
+
+	struct spatialgrid grid;
+	init_grid(&grid, points, CASTLE_SPAWN_DISTANCE);
+
+	for (size_t i = 0; i < candidates.size(); i++) {
+		if (near_grid(&towngrid, points[i], TOWN_SPAWN_DISTANCE)) {
+			continue;
+		}
+		if (near_grid(&grid, points[i], CASTLE_SPAWN_DISTANCE) == false) {
+			insert_grid(&grid, points[i]);
+			tiles[candidates[i]].site = CASTLE;
+		}
+	}
+}
+
+// villages can't border any other site
+// the chance is rolled for every candidate first, then a roll is kept unless an earlier kept village borders it
+static void spawn_villages(std::vector<struct tile> &tiles, const struct worldgraph *graph, const std::vector<uint32_t> &candidates, long seed)
+{
+	std::vector<uint32_t> order;
+	for (auto index : candidates) {
+		const struct tile *root = &tiles[index];
 		if (root->site == VACANT) {
 			bool valid = true;
-			for (auto neighbor : root->neighbors) {
-				if (neighbor->site != VACANT) {
+			for (uint32_t neighbor : graph->neighbors[index]) {
+				if (tiles[neighbor].site != VACANT) {
 					valid = false;
 					break;
 				}
@@ -1384,30 +1569,23 @@ static void spawn_villages(std::vector<struct tile*> &candidates, std::unordered
 				if (root->biome == FLOODPLAIN) {
 					p *= 2.f;
 				}
-				std::bernoulli_distribution d(p);
-				if (d(gen) == true) {
-					root->site = VILLAGE;
+				if (random_chance(seed, RANDOM_VILLAGES, index, p)) {
+					order.push_back(index);
 				}
 			}
 		}
 	}
-}
 
-static void import_pattern(const char *fpath, std::string &pattern)
-{
-	FILE *fp = fopen(fpath, "r");
-	if (!fp) {
-		perror("File opening failed");
-		pattern = "failure";
-		return;
-	}
-
-	int c;
-	while ((c = fgetc(fp)) != EOF) {
-		if (c != '\n') {
-			pattern.append(1, c);
+	for (auto index : order) {
+		bool valid = true;
+		for (uint32_t neighbor : graph->neighbors[index]) {
+			if (tiles[neighbor].site == VILLAGE) {
+				valid = false;
+				break;
+			}
+		}
+		if (valid) {
+			tiles[index].site = VILLAGE;
 		}
 	}
-
-	fclose(fp);
 }
@@ -26,12 +26,13 @@ enum BIOME : uint8_t {
 	BADLANDS
 };
 
+// graph data lives in the Worldmap adjacency arrays, nodes only refer to each other by index
 struct border {
 	int index;
-	struct corner *c0 = nullptr;
-	struct corner *c1 = nullptr;
-	struct tile *t0 = nullptr;
-	struct tile *t1 = nullptr;
+	uint32_t c0;
+	uint32_t c1;
+	uint32_t t0;
+	uint32_t t1;
 	// world data
 	bool frontier;
 	bool coast;
@@ -43,8 +44,6 @@ struct corner {
 	// graph data
 	int index;
 	glm::vec2 position;
-	std::vector<struct corner*> adjacent;
-	std::vector<struct tile*> touches;
 	// world data
 	bool frontier;
 	bool coast;
@@ -57,9 +56,6 @@ struct tile {
 	// graph data
 	int index;
 	glm::vec2 center;
-	std::vector<const struct tile*> neighbors;
-	std::vector<const struct corner*> corners;
-	std::vector<const struct border*> borders;
 	// world data
 	bool frontier;
 	bool land;
@@ -68,40 +64,90 @@ struct tile {
 	enum RELIEF relief;
 	enum BIOME biome;
 	enum SITE site;
-	std::string name;
-	struct holding *hold = nullptr;
+	uint32_t name = UNNAMED; // handle in the name pool of the world
+	int hold = -1; // index of the holding, -1 if the tile is not part of one
 };
 
+// the connectivity of the world in compressed sparse row form
+struct worldgraph {
+	struct adjacency neighbors; // tile to neighboring tiles
+	struct adjacency corners; // tile to its polygon corners
+	struct adjacency borders; // tile to its polygon borders
+	struct adjacency adjacent; // corner to adjacent corners
+	struct adjacency touches; // corner to the tiles that touch it
+	std::vector<uint32_t> neighbor_borders; // border shared with each neighbor, parallel to neighbors.links
+	std::vector<uint32_t> adjacent_borders; // border joining each adjacent corner, parallel to adjacent.links
+};
+
+#define NO_BORDER 0xffffffff
+
+// fills the border slots of the graph, call whenever the graph or borders are replaced
+void link_borders(struct worldgraph *graph, const std::vector<struct border> &borders);
+
+// border between two neighboring tiles or NO_BORDER if they aren't neighbors
+inline uint32_t tile_border(const struct worldgraph *graph, uint32_t a, uint32_t b)
+{
+	const struct span neighbors = graph->neighbors[a];
+	for (size_t i = 0; i < neighbors.size(); i++) {
+		if (neighbors[i] == b) { return graph->neighbor_borders[graph->neighbors.offsets[a] + i]; }
+	}
+	return NO_BORDER;
+}
+
+// border between two adjacent corners or NO_BORDER if they aren't adjacent
+inline uint32_t corner_border(const struct worldgraph *graph, uint32_t a, uint32_t b)
+{
+	const struct span adjacent = graph->adjacent[a];
+	for (size_t i = 0; i < adjacent.size(); i++) {
+		if (adjacent[i] == b) { return graph->adjacent_borders[graph->adjacent.offsets[a] + i]; }
+	}
+	return NO_BORDER;
+}
+
+#define NO_BRANCH 0xffffffff
+
+// river basins are binary trees stored together in one flat array of branches
+// every tree takes a contiguous range laid out in post order so tributaries always come before their confluence
 struct branch {
-	const struct corner *confluence = nullptr;
-	struct branch *left = nullptr;
-	struct branch *right = nullptr;
-	int streamorder;
-	int depth;
+	uint32_t confluence; // corner index
+	uint32_t parent = NO_BRANCH;
+	uint32_t left = NO_BRANCH;
+	uint32_t right = NO_BRANCH;
+	int streamorder = 1;
+	int depth = 0;
 };
 
 struct basin {
-	struct branch *mouth; // binary tree root
-	size_t height; // binary tree height
+	uint32_t first; // first branch of the tree
+	uint32_t mouth; // binary tree root, always the last branch of the tree
 };
 
 struct holding {
 	int index;
-	std::string name;
-	struct tile *center; // center tile of the hold that contains a fortification
-	std::vector<struct tile*> lands; // tiles that the holding consists of
-	std::vector<const struct holding*> neighbors; // neighbouring holds
+	uint32_t name = UNNAMED;
+	uint32_t center; // center tile of the hold that contains a fortification
+	std::vector<uint32_t> lands; // tiles that the holding consists of
+	std::vector<uint32_t> neighbors; // neighbouring holds
 };
 
-class Worldmap {
-public:
-	struct terraform terra;
+// everything that makes up a generated world without the state used to generate it
+// cheap to copy since the graph is index based, so it can be snapshotted for a background save
+struct worlddata {
 	std::vector<struct tile> tiles;
 	std::vector<struct corner> corners;
 	std::vector<struct border> borders;
-	std::list<struct basin> basins;
-	std::list<struct holding> holdings;
+	struct worldgraph graph;
+	struct components bodies; // landmass or sea of each tile
+	std::vector<struct branch> branches;
+	std::vector<struct basin> basins;
+	std::vector<struct holding> holdings;
+	struct namepool names;
 	long seed;
+};
+
+class Worldmap : public worlddata {
+public:
+	struct terraform terra;
 	struct rectangle area;
 public:
 	//Worldmap(long seed, struct rectangle area);
@@ -110,9 +156,15 @@ public:
 	~Worldmap(void);
 private:
 	struct worldparams params;
+	struct traversal walk;
+	// compiled once and reused by every world
+	struct namepattern regionnames;
+	struct namepattern townnames;
+	struct namepattern fortnames;
+	struct namepattern villagenames;
 private:
 	void gen_diagram(unsigned int maxcandidates);
-	void gen_relief(const struct byteimage *heightmap);
+	void gen_relief(void);
 	void gen_rivers(void);
 	void gen_biomes(void);
 	void gen_sites(void);
@@ -121,10 +173,11 @@ private:
 	void name_sites(void);
 	void floodfill_relief(unsigned int minsize, enum RELIEF target, enum RELIEF replacement);
 	void remove_echoriads(void);
-	void gen_drainage_basins(std::vector<const struct corner*> &graph);
+	void gen_drainage_basins(const std::vector<uint32_t> &candidates);
 	void trim_river_basins(void);
 	void correct_border_rivers(void);
 	void erode_mountains(void);
 	void correct_walls(void);
 	void trim_stubby_rivers(void);
+	std::vector<glm::vec2> terra_points(void) const;
 };
@@ -0,0 +1,726 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+#ifdef WORLDGEN_ZLIB
+#include <zlib.h>
+#endif
+
+#include "geom.h"
+#include "imp.h"
+#include "parallel.h"
+#include "graph.h"
+#include "components.h"
+#include "naming.h"
+#include "voronoi.h"
+#include "terra.h"
+#include "worldmap.h"
+#include "worldfile.h"
+#include "worldpack.h"
+
+// flag bits of NODE_FLAG and the bits needed for the enums
+#define FLAG_PLANES 5
+#define RELIEF_PLANES 2
+#define BIOME_PLANES 4
+#define SITE_PLANES 3
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_WINDOW 0xffff
+// no codec expands data more than zlib does, larger raw sizes can only come from a damaged file
+#define MAX_EXPANSION 1032
+// a match this long takes at least 4 bytes to store, which keeps the LZ codec under MAX_EXPANSION
+#define LZ_MAX_MATCH 4096
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(uint8_t(value) | 0x80);
+		value >>= 7;
+	}
+	out.push_back(uint8_t(value));
+}
+
+// differences are zigzag coded so small negative steps stay small too
+static void put_delta(std::vector<uint8_t> &out, int64_t value, int64_t *previous)
+{
+	int64_t delta = value - *previous;
+	*previous = value;
+	put_varint(out, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+}
+
+static void put_point(std::vector<uint8_t> &out, const glm::vec2 &point)
+{
+	const uint8_t *bytes = (const uint8_t*)&point;
+	out.insert(out.end(), bytes, bytes + sizeof(glm::vec2));
+}
+
+// every bit of the values is stored as its own plane of one bit per node
+static void put_planes(std::vector<uint8_t> &out, const std::vector<uint8_t> &values, int planes)
+{
+	for (int plane = 0; plane < planes; plane++) {
+		size_t first = out.size();
+		out.resize(first + (values.size() + 7) / 8, 0);
+		for (size_t i = 0; i < values.size(); i++) {
+			out[first + i / 8] |= ((values[i] >> plane) & 1) << (i % 8);
+		}
+	}
+}
+
+// node degrees followed by the links, each link relative to the one before it
+static void put_adjacency(std::vector<uint8_t> &out, const struct adjacency *graph)
+{
+	for (size_t node = 0; node < graph->size(); node++) {
+		put_varint(out, graph->offsets[node+1] - graph->offsets[node]);
+	}
+	int64_t previous = 0;
+	for (uint32_t link : graph->links) {
+		put_delta(out, link, &previous);
+	}
+}
+
+static void put_links(std::vector<uint8_t> &out, const std::vector<uint32_t> &links)
+{
+	int64_t previous = 0;
+	for (uint32_t link : links) {
+		put_delta(out, link, &previous);
+	}
+}
+
+// branch links are stored relative to the branch itself, 0 is left for NO_BRANCH
+static void put_relation(std::vector<uint8_t> &out, uint32_t value, size_t index)
+{
+	if (value == NO_BRANCH) {
+		put_varint(out, 0);
+	} else {
+		int64_t delta = int64_t(value) - int64_t(index);
+		put_varint(out, ((uint64_t(delta) << 1) ^ uint64_t(delta >> 63)) + 1);
+	}
+}
+
+static void encode_column(const struct worlddata *world, enum WORLDPACK_COLUMN column, std::vector<uint8_t> &out)
+{
+	const struct worldgraph *graph = &world->graph;
+	std::vector<uint8_t> values;
+	int64_t previous[4] = {0, 0, 0, 0};
+
+	switch (column) {
+	case COLUMN_TILE_CENTERS:
+		for (const auto &t : world->tiles) { put_point(out, t.center); }
+		break;
+	case COLUMN_TILE_FLAGS:
+		for (const auto &t : world->tiles) { values.push_back(pack_flags(t.frontier, t.land, t.coast, t.river, false)); }
+		put_planes(out, values, FLAG_PLANES);
+		break;
+	case COLUMN_TILE_RELIEF:
+		for (const auto &t : world->tiles) { values.push_back(t.relief); }
+		put_planes(out, values, RELIEF_PLANES);
+		break;
+	case COLUMN_TILE_BIOMES:
+		for (const auto &t : world->tiles) { values.push_back(t.biome); }
+		put_planes(out, values, BIOME_PLANES);
+		break;
+	case COLUMN_TILE_SITES:
+		for (const auto &t : world->tiles) { values.push_back(t.site); }
+		put_planes(out, values, SITE_PLANES);
+		break;
+	case COLUMN_TILE_HOLDS:
+		for (const auto &t : world->tiles) { put_delta(out, t.hold, &previous[0]); }
+		break;
+	case COLUMN_CORNER_POSITIONS:
+		for (const auto &c : world->corners) { put_point(out, c.position); }
+		break;
+	case COLUMN_CORNER_FLAGS:
+		for (const auto &c : world->corners) { values.push_back(pack_flags(c.frontier, false, c.coast, c.river, c.wall)); }
+		put_planes(out, values, FLAG_PLANES);
+		break;
+	case COLUMN_CORNER_DEPTHS:
+		for (const auto &c : world->corners) { put_delta(out, c.depth, &previous[0]); }
+		break;
+	case COLUMN_BORDER_ENDS:
+		for (const auto &b : world->borders) {
+			put_delta(out, b.c0, &previous[0]);
+			put_delta(out, b.c1, &previous[1]);
+			put_delta(out, b.t0, &previous[2]);
+			put_delta(out, b.t1, &previous[3]);
+		}
+		break;
+	case COLUMN_BORDER_FLAGS:
+		for (const auto &b : world->borders) { values.push_back(pack_flags(b.frontier, false, b.coast, b.river, b.wall)); }
+		put_planes(out, values, FLAG_PLANES);
+		break;
+	case COLUMN_NEIGHBORS: put_adjacency(out, &graph->neighbors); break;
+	case COLUMN_NEIGHBOR_BORDERS: put_links(out, graph->neighbor_borders); break;
+	case COLUMN_TILE_CORNERS: put_adjacency(out, &graph->corners); break;
+	case COLUMN_TILE_BORDERS: put_adjacency(out, &graph->borders); break;
+	case COLUMN_ADJACENT: put_adjacency(out, &graph->adjacent); break;
+	case COLUMN_ADJACENT_BORDERS: put_links(out, graph->adjacent_borders); break;
+	case COLUMN_TOUCHES: put_adjacency(out, &graph->touches); break;
+	case COLUMN_TILE_NAMES:
+		for (const auto &t : world->tiles) { put_varint(out, t.name); }
+		break;
+	case COLUMN_BRANCHES:
+		put_varint(out, world->branches.size());
+		for (size_t i = 0; i < world->branches.size(); i++) {
+			const struct branch *node = &world->branches[i];
+			put_delta(out, node->confluence, &previous[0]);
+			put_relation(out, node->parent, i);
+			put_relation(out, node->left, i);
+			put_relation(out, node->right, i);
+			put_varint(out, node->streamorder);
+			put_delta(out, node->depth, &previous[1]);
+		}
+		break;
+	case COLUMN_BASINS:
+		put_varint(out, world->basins.size());
+		for (const auto &basin : world->basins) {
+			put_delta(out, basin.first, &previous[0]);
+			put_delta(out, basin.mouth, &previous[1]);
+		}
+		break;
+	case COLUMN_HOLDINGS: {
+		struct adjacency lands;
+		struct adjacency neighbors;
+		put_varint(out, world->holdings.size());
+		for (const auto &hold : world->holdings) {
+			put_delta(out, hold.center, &previous[0]);
+			put_varint(out, hold.name);
+			lands.links.insert(lands.links.end(), hold.lands.begin(), hold.lands.end());
+			end_node(&lands);
+			neighbors.links.insert(neighbors.links.end(), hold.neighbors.begin(), hold.neighbors.end());
+			end_node(&neighbors);
+		}
+		put_adjacency(out, &lands);
+		put_adjacency(out, &neighbors);
+		break;
+	}
+	case COLUMN_NAMES:
+		out.insert(out.end(), world->names.chars.begin(), world->names.chars.end());
+		break;
+	case COLUMN_BODIES:
+		put_varint(out, world->bodies.size.size());
+		for (uint32_t size : world->bodies.size) { put_varint(out, size); }
+		put_varint(out, world->bodies.label.size());
+		for (uint32_t label : world->bodies.label) { put_delta(out, label, &previous[0]); }
+		break;
+	default: break;
+	}
+}
+
+// reads encoded bytes, a read past the end marks the reader as failed instead of stopping it
+struct bytereader {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool ok = true;
+};
+
+static uint64_t get_varint(struct bytereader *in)
+{
+	uint64_t value = 0;
+	for (int shift = 0; in->p < in->end && shift < 64; shift += 7) {
+		uint8_t byte = *in->p++;
+		value |= uint64_t(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) { return value; }
+	}
+	in->ok = false;
+
+	return 0;
+}
+
+static int64_t get_delta(struct bytereader *in, int64_t *previous)
+{
+	uint64_t zigzag = get_varint(in);
+	*previous += int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+
+	return *previous;
+}
+
+static glm::vec2 get_point(struct bytereader *in)
+{
+	glm::vec2 point = {0.f, 0.f};
+	if (size_t(in->end - in->p) < sizeof(glm::vec2)) {
+		in->ok = false;
+		return point;
+	}
+	memcpy(&point, in->p, sizeof(glm::vec2));
+	in->p += sizeof(glm::vec2);
+
+	return point;
+}
+
+static uint32_t get_relation(struct bytereader *in, size_t index)
+{
+	uint64_t value = get_varint(in);
+	if (value == 0) { return NO_BRANCH; }
+	value -= 1;
+
+	return int64_t(index) + (int64_t(value >> 1) ^ -int64_t(value & 1));
+}
+
+// counts are bounded by the bytes left since every element takes at least one
+static size_t get_count(struct bytereader *in)
+{
+	uint64_t count = get_varint(in);
+	if (count > uint64_t(in->end - in->p)) {
+		in->ok = false;
+		return 0;
+	}
+
+	return count;
+}
+
+static void get_planes(struct bytereader *in, std::vector<uint8_t> &values, size_t count, int planes)
+{
+	const size_t planesize = (count + 7) / 8;
+	values.assign(count, 0);
+	if (size_t(in->end - in->p) < planes * planesize) {
+		in->ok = false;
+		return;
+	}
+	for (int plane = 0; plane < planes; plane++) {
+		for (size_t i = 0; i < count; i++) {
+			values[i] |= ((in->p[i / 8] >> (i % 8)) & 1) << plane;
+		}
+		in->p += planesize;
+	}
+}
+
+static void get_links(struct bytereader *in, std::vector<uint32_t> &links, size_t count)
+{
+	// every link takes at least a byte
+	if (count > size_t(in->end - in->p)) {
+		in->ok = false;
+		return;
+	}
+	links.resize(count);
+	int64_t previous = 0;
+	for (size_t i = 0; i < count; i++) {
+		links[i] = get_delta(in, &previous);
+	}
+}
+
+static void get_adjacency(struct bytereader *in, struct adjacency *graph, size_t count)
+{
+	if (count > size_t(in->end - in->p)) {
+		in->ok = false;
+		return;
+	}
+	graph->offsets.resize(count + 1);
+	graph->offsets[0] = 0;
+	for (size_t node = 0; node < count; node++) {
+		// row sizes can't wrap the offsets around
+		uint64_t size = get_varint(in);
+		if (size > UINT32_MAX - graph->offsets[node]) {
+			in->ok = false;
+			return;
+		}
+		graph->offsets[node+1] = graph->offsets[node] + size;
+	}
+	get_links(in, graph->links, graph->offsets[count]);
+}
+
+static bool decode_column(struct worlddata *world, enum WORLDPACK_COLUMN column, const std::vector<uint8_t> &raw)
+{
+	struct bytereader reader = { raw.data(), raw.data() + raw.size() };
+	struct bytereader *in = &reader;
+	struct worldgraph *graph = &world->graph;
+	std::vector<uint8_t> values;
+	int64_t previous[4] = {0, 0, 0, 0};
+
+	switch (column) {
+	case COLUMN_TILE_CENTERS:
+		for (auto &t : world->tiles) { t.center = get_point(in); }
+		break;
+	case COLUMN_TILE_FLAGS:
+		get_planes(in, values, world->tiles.size(), FLAG_PLANES);
+		for (size_t i = 0; i < values.size(); i++) {
+			struct tile &t = world->tiles[i];
+			t.frontier = values[i] & FLAG_FRONTIER;
+			t.land = values[i] & FLAG_LAND;
+			t.coast = values[i] & FLAG_COAST;
+			t.river = values[i] & FLAG_RIVER;
+		}
+		break;
+	case COLUMN_TILE_RELIEF:
+		get_planes(in, values, world->tiles.size(), RELIEF_PLANES);
+		for (size_t i = 0; i < values.size(); i++) { world->tiles[i].relief = (enum RELIEF)values[i]; }
+		break;
+	case COLUMN_TILE_BIOMES:
+		get_planes(in, values, world->tiles.size(), BIOME_PLANES);
+		for (size_t i = 0; i < values.size(); i++) { world->tiles[i].biome = (enum BIOME)values[i]; }
+		break;
+	case COLUMN_TILE_SITES:
+		get_planes(in, values, world->tiles.size(), SITE_PLANES);
+		for (size_t i = 0; i < values.size(); i++) { world->tiles[i].site = (enum SITE)values[i]; }
+		break;
+	case COLUMN_TILE_HOLDS:
+		for (auto &t : world->tiles) { t.hold = get_delta(in, &previous[0]); }
+		break;
+	case COLUMN_CORNER_POSITIONS:
+		for (auto &c : world->corners) { c.position = get_point(in); }
+		break;
+	case COLUMN_CORNER_FLAGS:
+		get_planes(in, values, world->corners.size(), FLAG_PLANES);
+		for (size_t i = 0; i < values.size(); i++) {
+			struct corner &c = world->corners[i];
+			c.frontier = values[i] & FLAG_FRONTIER;
+			c.coast = values[i] & FLAG_COAST;
+			c.river = values[i] & FLAG_RIVER;
+			c.wall = values[i] & FLAG_WALL;
+		}
+		break;
+	case COLUMN_CORNER_DEPTHS:
+		for (auto &c : world->corners) { c.depth = get_delta(in, &previous[0]); }
+		break;
+	case COLUMN_BORDER_ENDS:
+		for (auto &b : world->borders) {
+			b.c0 = get_delta(in, &previous[0]);
+			b.c1 = get_delta(in, &previous[1]);
+			b.t0 = get_delta(in, &previous[2]);
+			b.t1 = get_delta(in, &previous[3]);
+		}
+		break;
+	case COLUMN_BORDER_FLAGS:
+		get_planes(in, values, world->borders.size(), FLAG_PLANES);
+		for (size_t i = 0; i < values.size(); i++) {
+			struct border &b = world->borders[i];
+			b.frontier = values[i] & FLAG_FRONTIER;
+			b.coast = values[i] & FLAG_COAST;
+			b.river = values[i] & FLAG_RIVER;
+			b.wall = values[i] & FLAG_WALL;
+		}
+		break;
+	case COLUMN_NEIGHBORS: get_adjacency(in, &graph->neighbors, world->tiles.size()); break;
+	case COLUMN_NEIGHBOR_BORDERS: get_links(in, graph->neighbor_borders, graph->neighbors.links.size()); break;
+	case COLUMN_TILE_CORNERS: get_adjacency(in, &graph->corners, world->tiles.size()); break;
+	case COLUMN_TILE_BORDERS: get_adjacency(in, &graph->borders, world->tiles.size()); break;
+	case COLUMN_ADJACENT: get_adjacency(in, &graph->adjacent, world->corners.size()); break;
+	case COLUMN_ADJACENT_BORDERS: get_links(in, graph->adjacent_borders, graph->adjacent.links.size()); break;
+	case COLUMN_TOUCHES: get_adjacency(in, &graph->touches, world->corners.size()); break;
+	case COLUMN_TILE_NAMES:
+		for (auto &t : world->tiles) { t.name = get_varint(in); }
+		break;
+	case COLUMN_BRANCHES:
+		world->branches.resize(get_count(in));
+		for (size_t i = 0; i < world->branches.size(); i++) {
+			struct branch *node = &world->branches[i];
+			node->confluence = get_delta(in, &previous[0]);
+			node->parent = get_relation(in, i);
+			node->left = get_relation(in, i);
+			node->right = get_relation(in, i);
+			node->streamorder = get_varint(in);
+			node->depth = get_delta(in, &previous[1]);
+		}
+		break;
+	case COLUMN_BASINS:
+		world->basins.resize(get_count(in));
+		for (auto &basin : world->basins) {
+			basin.first = get_delta(in, &previous[0]);
+			basin.mouth = get_delta(in, &previous[1]);
+		}
+		break;
+	case COLUMN_HOLDINGS: {
+		struct adjacency lands;
+		struct adjacency neighbors;
+		world->holdings.resize(get_count(in));
+		for (size_t i = 0; i < world->holdings.size(); i++) {
+			struct holding &hold = world->holdings[i];
+			hold.index = i;
+			hold.center = get_delta(in, &previous[0]);
+			hold.name = get_varint(in);
+		}
+		get_adjacency(in, &lands, world->holdings.size());
+		get_adjacency(in, &neighbors, world->holdings.size());
+		if (!in->ok) { return false; }
+		for (size_t i = 0; i < world->holdings.size(); i++) {
+			world->holdings[i].lands.assign(lands[i].begin(), lands[i].end());
+			world->holdings[i].neighbors.assign(neighbors[i].begin(), neighbors[i].end());
+		}
+		break;
+	}
+	case COLUMN_NAMES:
+		if (raw.empty()) {
+			reset_names(&world->names);
+		} else if (!adopt_names(&world->names, (const char*)raw.data(), raw.size())) {
+			return false;
+		}
+		in->p = in->end;
+		break;
+	case COLUMN_BODIES:
+		world->bodies.size.resize(get_count(in));
+		for (auto &size : world->bodies.size) { size = get_varint(in); }
+		world->bodies.label.resize(get_count(in));
+		for (auto &label : world->bodies.label) { label = get_delta(in, &previous[0]); }
+		break;
+	default: return false;
+	}
+
+	return reader.ok && reader.p == reader.end;
+}
+
+#ifndef WORLDGEN_ZLIB
+// only the compressor is left out of zlib builds, packs written without zlib can still be read
+// a sequence is a token with the literal count in the high nibble and the match length past the minimum in the low one
+// followed by the literals and the match offset, counts of 15 or more continue in a varint
+static void lz_sequence(std::vector<uint8_t> &out, const uint8_t *literals, size_t count, size_t offset, size_t length)
+{
+	size_t extra = length ? length - LZ_MIN_MATCH : 0;
+	out.push_back((std::min(count, size_t(15)) << 4) | std::min(extra, size_t(15)));
+	if (count >= 15) {
+		put_varint(out, count - 15);
+	}
+	out.insert(out.end(), literals, literals + count);
+	if (length) {
+		out.push_back(offset & 0xff);
+		out.push_back(offset >> 8);
+		if (extra >= 15) {
+			put_varint(out, extra - 15);
+		}
+	}
+}
+
+// greedy LZ77 with a single entry hash table, the stream always ends with a sequence without match
+static void lz_compress(const uint8_t *in, size_t size, std::vector<uint8_t> &out)
+{
+	std::vector<uint32_t> table(1 << LZ_HASH_BITS, 0);
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + LZ_MIN_MATCH <= size) {
+		uint32_t word;
+		memcpy(&word, in + i, 4);
+		uint32_t hash = (word * 2654435761U) >> (32 - LZ_HASH_BITS);
+		size_t candidate = table[hash];
+		table[hash] = i;
+		if (candidate < i && i - candidate <= LZ_WINDOW && memcmp(in + candidate, in + i, LZ_MIN_MATCH) == 0) {
+			size_t length = LZ_MIN_MATCH;
+			while (i + length < size && length < LZ_MAX_MATCH && in[candidate + length] == in[i + length]) {
+				length++;
+			}
+			lz_sequence(out, in + anchor, i - anchor, i - candidate, length);
+			i += length;
+			anchor = i;
+		} else {
+			i++;
+		}
+	}
+	lz_sequence(out, in + anchor, size - anchor, 0, 0);
+}
+#endif
+
+static bool lz_decompress(const std::vector<uint8_t> &stored, std::vector<uint8_t> &raw)
+{
+	struct bytereader reader = { stored.data(), stored.data() + stored.size() };
+	size_t position = 0;
+	while (reader.p < reader.end) {
+		uint8_t token = *reader.p++;
+		size_t count = token >> 4;
+		if (count == 15) { count += get_varint(&reader); }
+		if (!reader.ok || count > size_t(reader.end - reader.p) || count > raw.size() - position) {
+			return false;
+		}
+		memcpy(raw.data() + position, reader.p, count);
+		reader.p += count;
+		position += count;
+		if (reader.p == reader.end) { break; }
+
+		if (reader.end - reader.p < 2) { return false; }
+		size_t offset = reader.p[0] | (reader.p[1] << 8);
+		reader.p += 2;
+		size_t length = (token & 15) + LZ_MIN_MATCH;
+		if ((token & 15) == 15) { length += get_varint(&reader); }
+		if (!reader.ok || offset == 0 || offset > position || length > raw.size() - position) {
+			return false;
+		}
+		// matches can overlap their own output
+		for (size_t i = 0; i < length; i++) {
+			raw[position + i] = raw[position + i - offset];
+		}
+		position += length;
+	}
+
+	return position == raw.size();
+}
+
+static enum WORLDPACK_CODEC compress_column(const std::vector<uint8_t> &raw, std::vector<uint8_t> &stored)
+{
+#ifdef WORLDGEN_ZLIB
+	uLongf size = compressBound(raw.size());
+	stored.resize(size);
+	if (compress2(stored.data(), &size, raw.data(), raw.size(), Z_DEFAULT_COMPRESSION) == Z_OK && size < raw.size()) {
+		stored.resize(size);
+		return CODEC_ZLIB;
+	}
+#else
+	stored.clear();
+	lz_compress(raw.data(), raw.size(), stored);
+	if (stored.size() < raw.size()) {
+		return CODEC_LZ;
+	}
+#endif
+	stored = raw;
+
+	return CODEC_RAW;
+}
+
+static bool decompress_column(uint8_t codec, const std::vector<uint8_t> &stored, std::vector<uint8_t> &raw)
+{
+	switch (codec) {
+	case CODEC_RAW:
+		if (stored.size() != raw.size()) { return false; }
+		std::copy(stored.begin(), stored.end(), raw.begin());
+		return true;
+	case CODEC_LZ:
+		return lz_decompress(stored, raw);
+	case CODEC_ZLIB: {
+#ifdef WORLDGEN_ZLIB
+		uLongf size = raw.size();
+		return uncompress(raw.data(), &size, stored.data(), stored.size()) == Z_OK && size == raw.size();
+#else
+		fprintf(stderr, "World pack column is compressed with zlib but this build has no zlib\n");
+		return false;
+#endif
+	}
+	}
+
+	return false;
+}
+
+bool save_worldpack(const struct worlddata *world, const std::string &filepath)
+{
+	if (!little_endian_host()) {
+		fprintf(stderr, "World packs can only be written on little endian machines\n");
+		return false;
+	}
+
+	// columns are encoded and compressed independently of each other
+	std::vector<struct worldpack_column> columns(COLUMN_COUNT);
+	std::vector<std::vector<uint8_t>> stored(COLUMN_COUNT);
+	parallel_for(COLUMN_COUNT, 1, [&](size_t first, size_t last) {
+		std::vector<uint8_t> raw;
+		for (size_t i = first; i < last; i++) {
+			raw.clear();
+			encode_column(world, (enum WORLDPACK_COLUMN)i, raw);
+			struct worldpack_column &column = columns[i];
+			memset(&column, 0, sizeof(struct worldpack_column));
+			column.id = i;
+			column.codec = compress_column(raw, stored[i]);
+			column.rawsize = raw.size();
+			column.storedsize = stored[i].size();
+			column.checksum = checksum(raw.data(), raw.size());
+		}
+	});
+
+	struct worldpack_header header;
+	memset(&header, 0, sizeof(struct worldpack_header));
+	header.magic = WORLDPACK_MAGIC;
+	header.version = WORLDPACK_VERSION;
+	header.seed = world->seed;
+	header.tilecount = world->tiles.size();
+	header.cornercount = world->corners.size();
+	header.bordercount = world->borders.size();
+	header.columncount = COLUMN_COUNT;
+
+	std::string temppath = filepath + ".tmp";
+	FILE *fp = fopen(temppath.c_str(), "wb");
+	if (!fp) {
+		perror("File opening failed");
+		return false;
+	}
+
+	bool failed = fwrite(&header, sizeof(struct worldpack_header), 1, fp) != 1;
+	for (uint32_t i = 0; i < COLUMN_COUNT && !failed; i++) {
+		failed = fwrite(&columns[i], sizeof(struct worldpack_column), 1, fp) != 1;
+		failed = failed || fwrite(stored[i].data(), 1, stored[i].size(), fp) != stored[i].size();
+	}
+	failed = fclose(fp) != 0 || failed;
+	if (failed || rename(temppath.c_str(), filepath.c_str()) != 0) {
+		perror("Writing world pack failed");
+		remove(temppath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// sizes the node arrays for the header, the columns fill in the rest
+static void prepare_world(const struct worldpack_header *header, struct worlddata *world)
+{
+	world->seed = header->seed;
+
+	world->tiles.assign(header->tilecount, tile());
+	for (size_t i = 0; i < world->tiles.size(); i++) {
+		world->tiles[i].index = i;
+	}
+	world->corners.assign(header->cornercount, corner());
+	for (size_t i = 0; i < world->corners.size(); i++) {
+		world->corners[i].index = i;
+	}
+	world->borders.assign(header->bordercount, border());
+	for (size_t i = 0; i < world->borders.size(); i++) {
+		world->borders[i].index = i;
+	}
+
+	world->graph = worldgraph();
+}
+
+bool load_worldpack(const std::string &filepath, struct worlddata *world)
+{
+	if (!little_endian_host()) {
+		fprintf(stderr, "World packs can only be read on little endian machines\n");
+		return false;
+	}
+
+	FILE *fp = fopen(filepath.c_str(), "rb");
+	if (!fp) {
+		perror("File opening failed");
+		return false;
+	}
+	fseek(fp, 0, SEEK_END);
+	long remaining = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	struct worldpack_header header;
+	bool ok = fread(&header, sizeof(struct worldpack_header), 1, fp) == 1;
+	ok = ok && header.magic == WORLDPACK_MAGIC && header.version == WORLDPACK_VERSION && header.columncount == COLUMN_COUNT;
+	// every node takes at least a bit in the flag columns
+	ok = ok && size_t(header.tilecount) + header.cornercount + header.bordercount <= 8 * MAX_EXPANSION * size_t(remaining);
+	// decoded on the side so a malformed pack doesn't leave a half loaded world behind
+	struct worlddata loaded;
+	if (ok) {
+		prepare_world(&header, &loaded);
+		remaining -= sizeof(struct worldpack_header);
+	}
+
+	// one column in flight at a time, the buffers are reused
+	std::vector<uint8_t> stored;
+	std::vector<uint8_t> raw;
+	for (uint32_t i = 0; ok && i < COLUMN_COUNT; i++) {
+		struct worldpack_column column;
+		ok = fread(&column, sizeof(struct worldpack_column), 1, fp) == 1 && column.id == i;
+		remaining -= sizeof(struct worldpack_column);
+		ok = ok && column.storedsize <= uint64_t(std::max(remaining, 0L)) && column.rawsize <= MAX_EXPANSION * column.storedsize + 64;
+		if (!ok) { break; }
+		remaining -= column.storedsize;
+
+		stored.resize(column.storedsize);
+		raw.resize(column.rawsize);
+		ok = fread(stored.data(), 1, stored.size(), fp) == stored.size();
+		ok = ok && decompress_column(column.codec, stored, raw);
+		ok = ok && checksum(raw.data(), raw.size()) == column.checksum;
+		ok = ok && decode_column(&loaded, (enum WORLDPACK_COLUMN)i, raw);
+	}
+	fclose(fp);
+
+	if (!ok || !check_indices(&loaded)) {
+		fprintf(stderr, "Malformed world pack %s\n", filepath.c_str());
+		return false;
+	}
+	*world = std::move(loaded);
+
+	return true;
+}
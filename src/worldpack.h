@@ -0,0 +1,70 @@
+/*
+ * worldpack - compressed columnar world format for archiving
+ */
+
+#define WORLDPACK_MAGIC 0x4b415057 // "WPAK" in little endian
+#define WORLDPACK_VERSION 2
+
+// columns are stored in this order, a column can only be decoded once the ones it depends on are
+enum WORLDPACK_COLUMN : uint32_t {
+	COLUMN_TILE_CENTERS,
+	COLUMN_TILE_FLAGS,
+	COLUMN_TILE_RELIEF,
+	COLUMN_TILE_BIOMES,
+	COLUMN_TILE_SITES,
+	COLUMN_TILE_HOLDS,
+	COLUMN_CORNER_POSITIONS,
+	COLUMN_CORNER_FLAGS,
+	COLUMN_CORNER_DEPTHS,
+	COLUMN_BORDER_ENDS,
+	COLUMN_BORDER_FLAGS,
+	COLUMN_NEIGHBORS,
+	COLUMN_NEIGHBOR_BORDERS,
+	COLUMN_TILE_CORNERS,
+	COLUMN_TILE_BORDERS,
+	COLUMN_ADJACENT,
+	COLUMN_ADJACENT_BORDERS,
+	COLUMN_TOUCHES,
+	COLUMN_TILE_NAMES,
+	COLUMN_BRANCHES,
+	COLUMN_BASINS,
+	COLUMN_HOLDINGS,
+	COLUMN_NAMES,
+	COLUMN_BODIES,
+	COLUMN_COUNT
+};
+
+// zlib is used when the build defines WORLDGEN_ZLIB, otherwise the built in LZ codec
+enum WORLDPACK_CODEC : uint8_t {
+	CODEC_RAW, // stored as is because compression didn't pay off
+	CODEC_LZ,
+	CODEC_ZLIB
+};
+
+struct worldpack_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t seed;
+	uint32_t tilecount;
+	uint32_t cornercount;
+	uint32_t bordercount;
+	uint32_t columncount;
+};
+
+// precedes the stored bytes of every column
+struct worldpack_column {
+	uint32_t id;
+	uint8_t codec;
+	uint8_t reserved[3];
+	uint64_t rawsize; // encoded size before compression
+	uint64_t storedsize;
+	uint64_t checksum; // of the encoded bytes before compression
+};
+
+// writes the world as bit packed flags and enums, delta and varint coded indices and adjacency
+// with every column compressed on its own, returns false if it couldn't be written
+bool save_worldpack(const struct worlddata *world, const std::string &filepath);
+
+// streams the columns from the file and replaces the world once all of them decoded
+// only one column is held in memory at a time, returns false and leaves the world untouched if the file is missing or malformed
+bool load_worldpack(const std::string &filepath, struct worlddata *world);